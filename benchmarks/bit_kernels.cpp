@@ -0,0 +1,116 @@
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string_view>
+#include <vector>
+
+#include "bit_manipulation.hpp"
+
+
+/**
+ * @brief Kernels as they were before the header-only rewrite
+ *
+ */
+namespace legacy
+{
+
+int count(int16_t x)
+{
+    int count = 0;
+
+    do {
+        count += (x & 1);
+    } while (x >>= 1);
+
+    return count;
+}
+
+inline std::map<int16_t, int> mask = {
+    { 0b00'0000'0001, 1}, { 0b10'0000'0001, 1},
+    { 0b00'0000'0010, 2}, { 0b10'0000'0010, 2},
+    { 0b00'0000'0100, 3}, { 0b10'0000'0100, 3},
+    { 0b00'0000'1000, 4}, { 0b10'0000'1000, 4},
+    { 0b00'0001'0000, 5}, { 0b10'0001'0000, 5},
+    { 0b00'0010'0000, 6}, { 0b10'0010'0000, 6},
+    { 0b00'0100'0000, 7}, { 0b10'0100'0000, 7},
+    { 0b00'1000'0000, 8}, { 0b10'1000'0000, 8},
+    { 0b01'0000'0000, 9}, { 0b11'0000'0000, 9},
+};
+
+}  // namespace legacy
+
+
+/**
+ * @brief Keeps a value in memory, so that the work producing it is not
+ * optimised away
+ *
+ * @param value Value
+ */
+template <typename T>
+inline void escape(T& value)
+{
+#if defined(__GNUC__)
+    asm volatile("" : : "g"(&value) : "memory");
+#endif
+}
+
+/**
+ * @brief Times a kernel over all inputs and prints ns per call
+ *
+ * @param name Kernel name
+ * @param inputs Array of superpositions
+ * @param kernel Callable under test
+ */
+template <typename Kernel>
+void measure(std::string_view name, const std::vector<uint16_t>& inputs, Kernel kernel)
+{
+    constexpr int rounds = 100;
+
+    int acc = 0;
+
+    const auto begin = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; ++r) {
+        for (const uint16_t x : inputs) {
+            acc += kernel(x);
+        }
+    }
+    const auto end = std::chrono::steady_clock::now();
+    escape(acc);
+
+    const double ns = std::chrono::duration<double, std::nano>(end - begin).count();
+    std::cout << name << "\t" << ns / (rounds * inputs.size()) << " ns/op\n";
+}
+
+
+int main()
+{
+    constexpr int size = 1 << 16;
+
+    std::mt19937 g(42);
+    std::uniform_int_distribution<int> state(1, 0b11'1111'1111);
+    std::uniform_int_distribution<int> digit(0, 8);
+
+    // Entropy inputs: any superposition with the collapsed flag
+    std::vector<uint16_t> superpositions(size);
+    for (auto& x : superpositions) {
+        x = state(g);
+    }
+
+    // Digit inputs: a single candidate, collapsed or not
+    std::vector<uint16_t> singles(size);
+    for (auto& x : singles) {
+        x = (1 << digit(g)) | ((g() & 1) << 9);
+    }
+
+    measure("count/legacy", superpositions, [](uint16_t x) { return legacy::count(x); });
+    measure("count/table", superpositions, [](uint16_t x) { return bit::table::count(x); });
+    measure("count/bit", superpositions, [](uint16_t x) { return bit::count(x); });
+
+    measure("digit/legacy", singles, [](uint16_t x) { return legacy::mask.at(x); });
+    measure("digit/table", singles, [](uint16_t x) { return bit::table::lowest(x) + 1; });
+    measure("digit/bit", singles, [](uint16_t x) { return bit::lowest(x) + 1; });
+
+    return 0;
+}
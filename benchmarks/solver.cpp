@@ -0,0 +1,519 @@
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bitboard.hpp"
+#include "board.hpp"
+#include "dlx.hpp"
+#include "io.hpp"
+#include "stats.hpp"
+#include "sudoku.hpp"
+#include "utils.hpp"
+
+
+namespace sudoku
+{
+
+/**
+ * @brief Access to the private steps of the board, for benchmarking only
+ *
+ */
+struct board_probe {
+    // Removes the digit from the peers of the tile, as placing it does
+    template <int Box>
+    static bool propagate(q_board<Box>& board, const int idx, const int digit)
+    {
+        for (const int peer : peers::lookup<Box>.peers[idx]) {
+            if (!board.propagate(peer, digit)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template <int Box>
+    static bool infer(q_board<Box>& board, const int unit) { return board.infer(peers::lookup<Box>.units[unit]); }
+};
+
+}  // namespace sudoku
+
+
+namespace
+{
+
+using clock_type = std::chrono::steady_clock;
+using board_type = sudoku::q_board<BOX>;
+
+struct micro_result {
+    std::string name;
+    std::size_t ops;   // Calls per repetition
+    double ns_per_op;  // Median over the repetitions
+};
+
+struct macro_result {
+    std::string file;
+    std::string board;
+    std::size_t puzzles;
+    std::size_t unsolved;
+    double seconds;
+    std::vector<double> latencies;  // ns per puzzle, sorted
+    uint64_t nodes;                 // Search nodes, when statistics are built in
+};
+
+/**
+ * @brief Keeps a value in memory, so that the work producing it is not
+ * optimised away
+ *
+ * @param value Value
+ */
+template <typename T>
+inline void escape(T& value)
+{
+#if defined(__GNUC__)
+    asm volatile("" : : "g"(&value) : "memory");
+#endif
+}
+
+/**
+ * @brief Reads a whole string as a number
+ *
+ * @param sv String
+ * @param value Number read, left as is if the string does not start with one
+ * @return true if the whole string is a number in range
+ */
+template <typename T>
+bool to_number(std::string_view sv, T& value)
+{
+    const auto [end, error] = std::from_chars(sv.data(), sv.data() + sv.size(), value);
+    return !sv.empty() && error == std::errc() && end == sv.data() + sv.size();
+}
+
+/**
+ * @brief Nearest-rank percentile
+ *
+ * @param sorted Sorted samples
+ * @param q Quantile in [0, 1]
+ * @return Sample at the quantile, 0 if there is none
+ */
+double percentile(const std::vector<double>& sorted, const double q)
+{
+    if (sorted.empty()) {
+        return 0;
+    }
+    const std::size_t rank = std::ceil(q * sorted.size());
+    return sorted[std::clamp<std::size_t>(rank, 1, sorted.size()) - 1];
+}
+
+/**
+ * @brief Times an operation over all inputs. The number of rounds is chosen
+ * so that a repetition lasts a few tens of milliseconds, and the median of the
+ * repetitions is kept
+ *
+ * @param name Benchmark name
+ * @param nb_inputs Nb of inputs
+ * @param op Callable taking an input index, its result is kept alive
+ * @return Result
+ */
+template <typename Op>
+micro_result measure(std::string_view name, const std::size_t nb_inputs, Op op)
+{
+    constexpr int repetitions = 5;
+    constexpr double min_ns = 2e7;
+
+    int64_t acc = 0;
+
+    auto run = [&](const int rounds) {
+        const auto begin = clock_type::now();
+        for (int r = 0; r < rounds; ++r) {
+            for (std::size_t i = 0; i < nb_inputs; ++i) {
+                acc += op(i);
+            }
+        }
+        return std::chrono::duration<double, std::nano>(clock_type::now() - begin).count();
+    };
+
+    int rounds = 1;
+    for (double ns = run(rounds); ns < min_ns; ns = run(rounds)) {
+        rounds *= 2;
+    }
+
+    std::vector<double> samples;
+    for (int r = 0; r < repetitions; ++r) {
+        samples.push_back(run(rounds) / (rounds * nb_inputs));
+    }
+    escape(acc);
+
+    std::sort(samples.begin(), samples.end());
+    return {std::string(name), nb_inputs, samples[repetitions / 2]};
+}
+
+/**
+ * @brief Reads the 9x9 grids of a file
+ *
+ * @param path Path to file
+ * @param max_grids Nb of grids to read at most
+ * @return Grids
+ */
+std::vector<std::string> read_grids(const std::filesystem::path& path, const std::size_t max_grids)
+{
+    std::vector<std::string> grids;
+    io::mapped_file file(path);
+
+    if (!file.is_open()) {
+        return grids;
+    }
+
+    io::line_reader reader(file.data());
+    std::vector<std::string_view> lines;
+
+    while (grids.size() < max_grids && reader.next(lines, max_grids - grids.size())) {
+        for (const std::string_view line : lines) {
+            if (utils::box_of(line) == BOX) {
+                grids.emplace_back(line.substr(0, N * N));
+            }
+        }
+    }
+    return grids;
+}
+
+/**
+ * @brief Times the steps of the tile board on the states reached after
+ * reading the clues. Step timings include the copy of the board they run on,
+ * itself reported as 'copy'
+ *
+ * @param grids Puzzles
+ * @return Results
+ */
+std::vector<micro_result> run_micro(const std::vector<std::string>& grids)
+{
+    struct move {
+        std::size_t board;
+        int idx;
+        int digit;
+    };
+
+    std::vector<board_type> boards(grids.begin(), grids.end());
+    std::vector<move> moves;
+
+    for (std::size_t b = 0; b < boards.size(); ++b) {
+        const auto candidates = boards[b].get_candidates();
+
+        if (!candidates || !candidates->any()) {
+            // Solved or refuted by the clues alone
+            continue;
+        }
+
+        const int idx = candidates->nth(0);
+        std::array<int, N> possibilities;
+        boards[b].get_tile(idx).get_possibilities(possibilities);
+        moves.push_back({b, idx, possibilities[0]});
+    }
+
+    std::vector<micro_result> results;
+
+    results.push_back(measure("constructor", grids.size(), [&](const std::size_t i) {
+        const board_type board(grids[i]);
+        return board.get_tile(0).get_digit();
+    }));
+
+    results.push_back(measure("copy", boards.size(), [&](const std::size_t i) {
+        board_type board = boards[i];
+        escape(board);
+        return board.get_tile(i % (N * N)).get_digit();
+    }));
+
+    results.push_back(measure("collapse", moves.size(), [&](const std::size_t i) {
+        board_type board = boards[moves[i].board];
+        return board.collapse(moves[i].idx, moves[i].digit);
+    }));
+
+    for (const auto& [name, level] : {std::pair{"collapse/locked", sudoku::inference::locked},
+                                      std::pair{"collapse/subsets", sudoku::inference::subsets}}) {
+        std::vector<board_type> reduced;
+        for (const move& m : moves) {
+            reduced.emplace_back(grids[m.board], level);
+        }
+
+        results.push_back(measure(name, moves.size(), [&](const std::size_t i) {
+            board_type board = reduced[i];
+            return board.collapse(moves[i].idx, moves[i].digit);
+        }));
+    }
+
+    results.push_back(measure("propagate", moves.size(), [&](const std::size_t i) {
+        board_type board = boards[moves[i].board];
+        return sudoku::board_probe::propagate(board, moves[i].idx, moves[i].digit);
+    }));
+
+    results.push_back(measure("infer", boards.size(), [&](const std::size_t i) {
+        board_type board = boards[i];
+        return sudoku::board_probe::infer(board, i % sudoku::peers::nb_units<BOX>);
+    }));
+
+    results.push_back(measure("get_candidates", boards.size(), [&](const std::size_t i) {
+        const auto candidates = boards[i].get_candidates();
+        return candidates ? candidates->count() : -1;
+    }));
+
+    results.push_back(measure("serialize", boards.size(), [&](const std::size_t i) {
+        return boards[i].serialize().back();
+    }));
+
+    return results;
+}
+
+/**
+ * @brief Solves every puzzle of a file one after the other, timing each one
+ *
+ * @param path Path to file
+ * @param board_name Board name in the report
+ * @param seed Base seed, puzzle i using stream i
+ * @param solve Callable taking a grid, true if solved
+ * @return Result
+ */
+template <typename Solve>
+macro_result time_file(const std::filesystem::path& path,
+                       const std::string& board_name,
+                       const uint64_t seed,
+                       Solve solve)
+{
+    const std::vector<std::string> grids = read_grids(path, -1);
+    macro_result result{path.filename().string(), board_name, grids.size(), 0, 0, {}, 0};
+    result.latencies.reserve(grids.size());
+
+    const auto begin = clock_type::now();
+
+    for (std::size_t i = 0; i < grids.size(); ++i) {
+        utils::seed(utils::stream_seed(seed, i));
+
+        stats::take();
+
+        const auto start = clock_type::now();
+        const bool solved = solve(grids[i]);
+        const auto stop = clock_type::now();
+
+        result.nodes += stats::take().nodes;
+        result.unsolved += !solved;
+        result.latencies.push_back(std::chrono::duration<double, std::nano>(stop - start).count());
+    }
+
+    result.seconds = std::chrono::duration<double>(clock_type::now() - begin).count();
+    std::sort(result.latencies.begin(), result.latencies.end());
+    return result;
+}
+
+/**
+ * @brief Solves every puzzle of a file with the WFC on a board
+ *
+ * @param path Path to file
+ * @param board_name Board name in the report
+ * @param seed Base seed, puzzle i using stream i
+ * @param options Engine and limits of the search
+ * @param board_args Extra arguments of the board constructor
+ * @return Result
+ */
+template <typename Board, typename... Args>
+macro_result run_macro(const std::filesystem::path& path,
+                       const std::string& board_name,
+                       const uint64_t seed,
+                       const sudoku::wfc::solve_options& options,
+                       const Args... board_args)
+{
+    return time_file(path, board_name, seed, [&](const std::string& grid) {
+        Board board(grid, board_args...);
+        return sudoku::wfc::solve(board, options) == sudoku::wfc::status::solved;
+    });
+}
+
+/**
+ * @brief Solves every puzzle of a file with dancing links
+ *
+ * @param path Path to file
+ * @param seed Base seed, unused by the deterministic search
+ * @return Result
+ */
+macro_result run_dlx(const std::filesystem::path& path, const uint64_t seed)
+{
+    return time_file(path, "dlx", seed, [](const std::string& grid) {
+        std::string solution = grid;
+        return sudoku::dlx::solve<BOX>(solution) == sudoku::wfc::status::solved;
+    });
+}
+
+/**
+ * @brief Writes the results as JSON, to compare runs between releases
+ *
+ * @param path Path to output file
+ * @param seed Base seed
+ * @param engine Engine name
+ * @param micro Microbenchmark results
+ * @param macro Macro benchmark results
+ */
+void write_json(const std::filesystem::path& path,
+                const uint64_t seed,
+                std::string_view engine,
+                const std::vector<micro_result>& micro,
+                const std::vector<macro_result>& macro)
+{
+    std::ofstream file(path);
+    file << std::fixed << std::setprecision(1);
+
+    file << "{\n"
+         << "  \"context\": {\"seed\": " << seed << ", \"engine\": \"" << engine << "\", \"threads\": 1},\n"
+         << "  \"micro\": [";
+
+    for (std::size_t i = 0; i < micro.size(); ++i) {
+        const micro_result& r = micro[i];
+        file << (i ? ",\n" : "\n")
+             << "    {\"name\": \"" << r.name << "\", \"ops\": " << r.ops
+             << ", \"ns_per_op\": " << r.ns_per_op << "}";
+    }
+
+    file << "\n  ],\n  \"macro\": [";
+
+    for (std::size_t i = 0; i < macro.size(); ++i) {
+        const macro_result& r = macro[i];
+        file << (i ? ",\n" : "\n")
+             << "    {\"file\": \"" << r.file << "\", \"board\": \"" << r.board
+             << "\", \"puzzles\": " << r.puzzles << ", \"unsolved\": " << r.unsolved
+             << ", \"puzzles_per_s\": " << r.puzzles / r.seconds
+             << ", \"ns_per_puzzle\": " << r.seconds * 1e9 / r.puzzles
+             << ", \"p50_ns\": " << percentile(r.latencies, 0.50)
+             << ", \"p99_ns\": " << percentile(r.latencies, 0.99)
+             << ", \"max_ns\": " << percentile(r.latencies, 1.0);
+        if (stats::enabled) {
+            file << ", \"nodes_per_puzzle\": " << static_cast<double>(r.nodes) / r.puzzles;
+        }
+        file << "}";
+    }
+
+    file << "\n  ]\n}\n";
+}
+
+}  // namespace
+
+
+int main(int argc, const char* argv[])
+{
+    std::vector<std::filesystem::path> paths;
+    std::optional<std::filesystem::path> json;
+    uint64_t seed = 1;
+    sudoku::wfc::engine engine = sudoku::wfc::engine::copy;
+    uint64_t restart_base = 16;
+    bool micro = true;
+
+    for (int a = 1; a < argc; ++a) {
+        const std::string_view arg = argv[a];
+
+        if (arg.starts_with("--json=")) {
+            json = arg.substr(7);
+        } else if (arg.starts_with("--seed=") && to_number(arg.substr(7), seed)) {
+            continue;
+        } else if (arg == "--engine=trail") {
+            engine = sudoku::wfc::engine::trail;
+        } else if (arg == "--engine=copy") {
+            engine = sudoku::wfc::engine::copy;
+        } else if (arg.starts_with("--restarts=") && to_number(arg.substr(11), restart_base)) {
+            continue;
+        } else if (arg == "--no-micro") {
+            micro = false;
+        } else if (!arg.starts_with("--")) {
+            paths.emplace_back(arg);
+        } else {
+            std::cerr << "Usage: bench_solver [--json=<output>] [--seed=<n>] "
+                         "[--engine=copy|trail] [--restarts=<n>] [--no-micro] [files...]\n";
+            return 1;
+        }
+    }
+
+    if (paths.empty()) {
+        paths = {"data/hard1.txt", "data/hard10.txt", "data/benchmark10k.txt"};
+    }
+
+    std::vector<micro_result> micro_results;
+    std::vector<macro_result> macro_results;
+
+    if (micro) {
+        const std::vector<std::string> grids = read_grids(paths.back(), 1000);
+
+        if (grids.empty()) {
+            std::cerr << "No 9x9 grid in '" << paths.back().string() << "'.\n";
+            return 1;
+        }
+
+        std::cout << "Micro (" << grids.size() << " grids of " << paths.back().string() << ")\n";
+        micro_results = run_micro(grids);
+
+        for (const micro_result& r : micro_results) {
+            std::cout << "  " << std::left << std::setw(16) << r.name << std::right
+                      << std::fixed << std::setprecision(1) << std::setw(10) << r.ns_per_op << " ns/op\n";
+        }
+    }
+
+    std::cout << "Macro\n"
+              << "  " << std::left << std::setw(20) << "file" << std::setw(14) << "board" << std::right
+              << std::setw(9) << "puzzles" << std::setw(13) << "puzzles/s" << std::setw(13) << "ns/puzzle"
+              << std::setw(13) << "p50 ns" << std::setw(13) << "p99 ns" << std::setw(13) << "max ns"
+              << (stats::enabled ? "   nodes/puzzle" : "") << "\n";
+
+    for (const std::filesystem::path& path : paths) {
+        using sudoku::inference;
+
+        sudoku::wfc::solve_options plain;
+        plain.e = engine;
+
+        sudoku::wfc::solve_options restarts = plain;
+        restarts.restart_base = restart_base;
+
+        // Each run is printed as soon as it is done
+        const std::vector<std::function<macro_result()>> runs{
+            [&] { return run_macro<board_type>(path, "tile", seed, plain, inference::singles); },
+            [&] { return run_macro<board_type>(path, "tile+restarts", seed, restarts, inference::singles); },
+            [&] { return run_macro<board_type>(path, "tile+locked", seed, plain, inference::locked); },
+            [&] { return run_macro<board_type>(path, "tile+subsets", seed, plain, inference::subsets); },
+            [&] { return run_macro<sudoku::bitboard>(path, "simd", seed, plain); },
+            [&] { return run_macro<sudoku::bitboard>(path, "simd+restarts", seed, restarts); },
+            [&] { return run_dlx(path, seed); }};
+
+        for (const auto& run : runs) {
+            const macro_result r = run();
+
+            if (!r.puzzles) {
+                std::cerr << "No 9x9 grid in '" << path.string() << "'.\n";
+                break;
+            }
+
+            std::cout << "  " << std::left << std::setw(20) << r.file << std::setw(14) << r.board << std::right
+                      << std::setw(9) << r.puzzles << std::fixed << std::setprecision(0)
+                      << std::setw(13) << r.puzzles / r.seconds << std::setw(13) << r.seconds * 1e9 / r.puzzles
+                      << std::setw(13) << percentile(r.latencies, 0.50)
+                      << std::setw(13) << percentile(r.latencies, 0.99)
+                      << std::setw(13) << percentile(r.latencies, 1.0);
+            if (stats::enabled) {
+                std::cout << std::setprecision(1) << std::setw(15) << static_cast<double>(r.nodes) / r.puzzles;
+            }
+            std::cout << (r.unsolved ? "  (" + std::to_string(r.unsolved) + " unsolved)" : "") << "\n";
+
+            macro_results.push_back(r);
+        }
+    }
+
+    if (json) {
+        write_json(*json, seed, engine == sudoku::wfc::engine::trail ? "trail" : "copy",
+                   micro_results, macro_results);
+        std::cout << "Results written to " << json->string() << "\n";
+    }
+
+    return 0;
+}
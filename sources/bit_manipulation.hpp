@@ -1,25 +1,190 @@
 #pragma once
 
-#include <map>
+#include <array>
+#include <concepts>
+#include <cstdint>
+#include <version>
+
+#if defined(__cpp_lib_bitops)
+#include <bit>
+#endif
 
 namespace bit {
 
-inline int16_t set(const int16_t x, const int n)    { return x | (1 << n); }
-inline int16_t clear(const int16_t x, const int n)  { return x & ~(1 << n); }
-inline int16_t toggle(const int16_t x, const int n) { return x ^ (1 << n); }
-inline bool check(const int16_t x, const int n) { return (x >> n) & 1; }
-int count(int16_t x);
-
-inline std::map<int16_t, int> mask = {
-    { 0b00'0000'0001, 1}, { 0b10'0000'0001, 1},
-    { 0b00'0000'0010, 2}, { 0b10'0000'0010, 2},
-    { 0b00'0000'0100, 3}, { 0b10'0000'0100, 3},
-    { 0b00'0000'1000, 4}, { 0b10'0000'1000, 4},
-    { 0b00'0001'0000, 5}, { 0b10'0001'0000, 5},
-    { 0b00'0010'0000, 6}, { 0b10'0010'0000, 6},
-    { 0b00'0100'0000, 7}, { 0b10'0100'0000, 7},
-    { 0b00'1000'0000, 8}, { 0b10'1000'0000, 8},
-    { 0b01'0000'0000, 9}, { 0b11'0000'0000, 9},
+template <std::unsigned_integral T> inline constexpr T set(const T x, const int n)    { return x | (T{1} << n); }
+template <std::unsigned_integral T> inline constexpr T clear(const T x, const int n)  { return x & ~(T{1} << n); }
+template <std::unsigned_integral T> inline constexpr T toggle(const T x, const int n) { return x ^ (T{1} << n); }
+template <std::unsigned_integral T> inline constexpr bool check(const T x, const int n) { return (x >> n) & 1; }
+
+/**
+ * @brief Byte-wise lookup tables, used when no intrinsic is available
+ *
+ */
+namespace table
+{
+
+inline constexpr std::array<uint8_t, 256> counts = [] {
+    std::array<uint8_t, 256> t{};
+    for (int x = 1; x < 256; ++x) {
+        t[x] = t[x >> 1] + (x & 1);
+    }
+    return t;
+}();
+
+inline constexpr std::array<uint8_t, 256> lowests = [] {
+    std::array<uint8_t, 256> t{};
+    t[0] = 8;
+    for (int x = 1; x < 256; ++x) {
+        t[x] = (x & 1) ? 0 : t[x >> 1] + 1;
+    }
+    return t;
+}();
+
+template <std::unsigned_integral T>
+inline constexpr int count(T x)
+{
+    int c = 0;
+    for (; x; x >>= 8) {
+        c += counts[x & 0xFF];
+    }
+    return c;
+}
+
+template <std::unsigned_integral T>
+inline constexpr int lowest(T x)
+{
+    int shift = 0;
+    for (; !(x & 0xFF); x >>= 8) {
+        shift += 8;
+    }
+    return shift + lowests[x & 0xFF];
+}
+
+}  // namespace table
+
+/**
+ * @brief Number of set bits
+ *
+ * @param x Bit set
+ * @return Population count
+ */
+template <std::unsigned_integral T>
+inline constexpr int count(const T x)
+{
+#if defined(__cpp_lib_bitops)
+    return std::popcount(x);
+#elif defined(__GNUC__)
+    return __builtin_popcountll(x);
+#else
+    return table::count(x);
+#endif
+}
+
+/**
+ * @brief Position of the lowest set bit
+ *
+ * @param x Non-null bit set
+ * @return Index of the lowest set bit
+ */
+template <std::unsigned_integral T>
+inline constexpr int lowest(const T x)
+{
+#if defined(__cpp_lib_bitops)
+    return std::countr_zero(x);
+#elif defined(__GNUC__)
+    return __builtin_ctzll(x);
+#else
+    return table::lowest(x);
+#endif
+}
+
+/**
+ * @brief Position of the highest set bit
+ *
+ * @param x Non-null bit set
+ * @return Index of the highest set bit
+ */
+template <std::unsigned_integral T>
+inline constexpr int highest(const T x)
+{
+#if defined(__cpp_lib_bitops)
+    return std::bit_width(x) - 1;
+#elif defined(__GNUC__)
+    return 63 - __builtin_clzll(x);
+#else
+    int h = 0;
+    for (T y = x; y >>= 1;) {
+        ++h;
+    }
+    return h;
+#endif
+}
+
+/**
+ * @brief Set of indices in [0, Size), e.g. tiles of a board
+ *
+ */
+template <int Size>
+class index_set final
+{
+public:
+    static constexpr int nb_words = (Size + 63) / 64;
+    using words = std::array<uint64_t, nb_words>;
+
+    constexpr index_set() = default;
+    constexpr explicit index_set(const words& w) : _words(w) {}
+
+    inline constexpr void insert(const int i) { _words[i >> 6] |= uint64_t{1} << (i & 63); }
+    inline constexpr void erase(const int i) { _words[i >> 6] &= ~(uint64_t{1} << (i & 63)); }
+    inline constexpr bool contains(const int i) const { return (_words[i >> 6] >> (i & 63)) & 1; }
+
+    inline constexpr bool any() const
+    {
+        uint64_t any = 0;
+        for (const uint64_t w : _words) {
+            any |= w;
+        }
+        return any;
+    }
+
+    inline constexpr int count() const
+    {
+        int c = 0;
+        for (const uint64_t w : _words) {
+            c += bit::count(w);
+        }
+        return c;
+    }
+
+    /**
+     * @brief Index of the k-th smallest element
+     *
+     * @param k Rank, lower than count()
+     * @return Element
+     */
+    inline constexpr int nth(int k) const
+    {
+        for (int w = 0; w < nb_words; ++w) {
+            uint64_t word = _words[w];
+            const int c = bit::count(word);
+
+            if (k >= c) {
+                k -= c;
+                continue;
+            }
+
+            for (; k > 0; --k) {
+                word &= word - 1;  // Drops lowest element
+            }
+            return 64 * w + bit::lowest(word);
+        }
+        return -1;
+    }
+
+private:
+    words _words{};
 };
 
+using set128 = index_set<128>;
+
 } // namespace bit
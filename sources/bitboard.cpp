@@ -0,0 +1,305 @@
+#include "bitboard.hpp"
+
+#include "stats.hpp"
+
+
+namespace sudoku
+{
+
+namespace
+{
+
+/**
+ * @brief Lane words with one bit per listed tile
+ *
+ * @param tiles Tile indices
+ * @return Words of the lane
+ */
+template <typename Array>
+constexpr lane::words make_words(const Array& tiles)
+{
+    lane::words w{};
+    for (const int idx : tiles) {
+        w[idx >> 6] |= uint64_t{1} << (idx & 63);
+    }
+    return w;
+}
+
+struct alignas(64) masks {
+    std::array<lane::words, N * N> peers;                        // Peers of each tile
+    std::array<lane::words, sudoku::peers::nb_units<BOX>> units;  // Members of each unit
+    lane::words board;                                           // All tiles
+};
+
+constexpr masks make_masks()
+{
+    masks m{};
+
+    for (int idx = 0; idx < N * N; ++idx) {
+        m.peers[idx] = make_words(peers::lookup<BOX>.peers[idx]);
+        m.board[idx >> 6] |= uint64_t{1} << (idx & 63);
+    }
+    for (int u = 0; u < peers::nb_units<BOX>; ++u) {
+        m.units[u] = make_words(peers::lookup<BOX>.units[u]);
+    }
+    return m;
+}
+
+inline constexpr masks lookup = make_masks();
+
+/**
+ * @brief Calls f on every tile of the lane
+ *
+ * @param tiles Lane of tiles
+ * @param f Callable taking a tile index
+ */
+template <typename F>
+inline void for_each(const lane& tiles, F f)
+{
+    for (uint64_t w = tiles.lo(); w; w &= w - 1) {
+        f(bit::lowest(w));
+    }
+    for (uint64_t w = tiles.hi(); w; w &= w - 1) {
+        f(64 + bit::lowest(w));
+    }
+}
+
+}  // namespace
+
+
+/**
+ * @brief Construct an empty board, every digit possible everywhere
+ *
+ */
+bitboard::bitboard()
+{
+    _planes.fill(lane(lookup.board));
+}
+
+/**
+ * @brief Construct a new bitboard object
+ *
+ * @param grid A N*N string of numbers and blank spaces
+ */
+bitboard::bitboard(std::string_view grid) : bitboard()
+{
+    for (int idx = 0; idx < N * N; ++idx) {
+        const int digit = utils::to_digit(grid[idx]);
+
+        if (!digit || digit > N) {
+            continue;
+        }
+
+        if (!_planes[digit - 1].contains(idx)) {
+            // Digit already taken by a peer clue
+            // Leaves no possibility anywhere so that no search starts
+            _planes.fill(lane());
+            return;
+        }
+        place(idx, digit);
+    }
+
+    if (!propagate()) {
+        // Inconsistent clues
+        // Leaves no possibility anywhere
+        _planes.fill(lane());
+    }
+}
+
+/**
+ * @brief Gathers the tile from the digit planes
+ *
+ * @param index The tile index
+ * @return Tile
+ */
+q_tile<BOX> bitboard::get_tile(const int index) const
+{
+    uint16_t superposition = _collapsed.contains(index) ? (1 << N) : 0;
+
+    for (int d = 0; d < N; ++d) {
+        superposition |= _planes[d].contains(index) << d;
+    }
+    return q_tile<BOX>(superposition);
+}
+
+/**
+ * @brief Checks if a tile has no possibility left
+ *
+ * @return true if no solution is possible
+ */
+bool bitboard::has_contradiction() const
+{
+    lane possible;
+    for (const lane& plane : _planes) {
+        possible = possible | plane;
+    }
+    return lane(lookup.board).andnot(possible).any();
+}
+
+/**
+ * @brief Get the tiles with minimal entropy. Counts, for all tiles at once,
+ * the possibilities of each tile as a 4-bit number sliced over 4 lanes
+ *
+ * @return std::optional set of tiles, empty if all tiles have collapsed
+ */
+std::optional<bit::set128> bitboard::get_candidates() const
+{
+    const lane open = lane(lookup.board).andnot(_collapsed);
+    std::array<lane, 4> count;
+
+    for (const lane& plane : _planes) {
+        // Adds one to the count of every open tile of the plane
+        lane carry = plane & open;
+        for (lane& c : count) {
+            const lane next = c & carry;
+            c = (c | carry).andnot(next);
+            carry = next;
+        }
+    }
+
+    for (int entropy = 0; entropy <= N; ++entropy) {
+        lane tiles = open;
+        for (int b = 0; b < 4; ++b) {
+            tiles = ((entropy >> b) & 1) ? (tiles & count[b]) : tiles.andnot(count[b]);
+        }
+
+        if (!tiles.any()) {
+            continue;
+        }
+
+        if (!entropy) {
+            // No solution possible
+            return std::nullopt;
+        }
+        return tiles.to_set();
+    }
+
+    return bit::set128{};
+}
+
+/**
+ * @brief Output board
+ *
+ * @return The string format of board
+ */
+std::string bitboard::serialize() const
+{
+    std::string grid(N * N, '.');
+
+    for (int d = 0; d < N; ++d) {
+        for_each(_planes[d] & _collapsed, [&](const int idx) {
+            grid[idx] = '1' + d;
+        });
+    }
+    return grid;
+}
+
+/**
+ * @brief Sets a tile to a specific value and propagates to a fixed point
+ *
+ * @param idx The tile index
+ * @param digit The chosen value
+ * @return true if tile was set to value,
+ * @return false otherwise
+ */
+bool bitboard::collapse(const int idx, const int digit)
+{
+    if (_collapsed.contains(idx)) {
+        // Asserts that collapsed tile has the correct value
+        return _planes[digit - 1].contains(idx);
+    }
+
+    place(idx, digit);
+    return propagate();
+}
+
+/**
+ * @brief Sets a tile and removes its digit from its peers. If the digit was
+ * not possible, the tile is left without possibility
+ *
+ * @param idx The tile index
+ * @param digit The chosen value
+ */
+void bitboard::place(const int idx, const int digit)
+{
+    const lane tile = lane::tile(idx);
+    lane& plane = _planes[digit - 1];
+    const bool possible = plane.contains(idx);
+
+    for (lane& p : _planes) {
+        p = p.andnot(tile);
+    }
+
+    plane = plane.andnot(lane(lookup.peers[idx]));
+    if (possible) {
+        plane = plane | tile;
+    }
+
+    _collapsed = _collapsed | tile;
+}
+
+/**
+ * @brief Collapses naked singles (tiles with a single possibility) and hidden
+ * singles (digits with a single place in a unit) until none is left
+ *
+ * @return false if propagation results in inconsistency,
+ * @return true otherwise
+ */
+bool bitboard::propagate()
+{
+    const lane board(lookup.board);
+
+    while (true) {
+        // Tiles with at least one and with at least two possibilities
+        lane once, twice;
+        for (const lane& plane : _planes) {
+            twice = twice | (once & plane);
+            once = once | plane;
+        }
+
+        if (board.andnot(once).any()) {
+            // Found a tile without possibility
+            return false;
+        }
+
+        if (const lane singles = once.andnot(twice).andnot(_collapsed); singles.any()) {
+            for (int d = 0; d < N; ++d) {
+                for_each(singles & _planes[d], [&](const int idx) {
+                    stats::cascade();
+                    place(idx, d + 1);
+                });
+            }
+            continue;
+        }
+
+        bool inferred = false;
+
+        for (int d = 0; d < N; ++d) {
+            if (!_planes[d].andnot(_collapsed).any()) {
+                // Digit already placed everywhere
+                continue;
+            }
+
+            for (const lane::words& unit : lookup.units) {
+                const lane places = _planes[d] & lane(unit);
+
+                if (!places.any()) {
+                    // Digit has no place left in the unit
+                    return false;
+                }
+
+                if (places.single() && !(places & _collapsed).any()) {
+                    stats::cascade();
+                    place(places.lowest(), d + 1);
+                    inferred = true;
+                }
+            }
+        }
+
+        if (!inferred) {
+            return true;
+        }
+    }
+}
+
+}  // namespace sudoku
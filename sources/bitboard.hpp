@@ -0,0 +1,111 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "bit_manipulation.hpp"
+#include "board.hpp"
+#include "peers.hpp"
+
+
+namespace sudoku
+{
+
+static_assert(N * N <= 128, "Digit planes hold at most 128 tiles");
+
+/**
+ * @brief One bit per tile, held in an SSE2 register when available
+ */
+class lane final
+{
+public:
+    using words = std::array<uint64_t, 2>;
+
+#if defined(__SSE2__)
+    inline lane() : _v(_mm_setzero_si128()) {}
+    inline explicit lane(const words& w) : _v(_mm_loadu_si128(reinterpret_cast<const __m128i*>(w.data()))) {}
+
+    inline lane operator&(const lane& o) const { return lane(_mm_and_si128(_v, o._v)); }
+    inline lane operator|(const lane& o) const { return lane(_mm_or_si128(_v, o._v)); }
+    inline lane andnot(const lane& o) const { return lane(_mm_andnot_si128(o._v, _v)); }
+
+    inline uint64_t lo() const { return static_cast<uint64_t>(_mm_cvtsi128_si64(_v)); }
+    inline uint64_t hi() const { return static_cast<uint64_t>(_mm_cvtsi128_si64(_mm_unpackhi_epi64(_v, _v))); }
+
+    inline bool any() const { return _mm_movemask_epi8(_mm_cmpeq_epi8(_v, _mm_setzero_si128())) != 0xFFFF; }
+#else
+    inline lane() : _v{} {}
+    inline explicit lane(const words& w) : _v(w) {}
+
+    inline lane operator&(const lane& o) const { return lane(words{_v[0] & o._v[0], _v[1] & o._v[1]}); }
+    inline lane operator|(const lane& o) const { return lane(words{_v[0] | o._v[0], _v[1] | o._v[1]}); }
+    inline lane andnot(const lane& o) const { return lane(words{_v[0] & ~o._v[0], _v[1] & ~o._v[1]}); }
+
+    inline uint64_t lo() const { return _v[0]; }
+    inline uint64_t hi() const { return _v[1]; }
+
+    inline bool any() const { return _v[0] | _v[1]; }
+#endif
+
+    static inline lane tile(const int idx) { return lane(words{idx < 64 ? uint64_t{1} << idx : 0, idx < 64 ? 0 : uint64_t{1} << (idx - 64)}); }
+
+    inline bool contains(const int idx) const { return ((idx < 64 ? lo() : hi()) >> (idx & 63)) & 1; }
+    inline bool single() const { const uint64_t l = lo(), h = hi(); return l ? !(l & (l - 1)) && !h : h && !(h & (h - 1)); }
+    inline int lowest() const { const uint64_t l = lo(); return l ? bit::lowest(l) : 64 + bit::lowest(hi()); }
+
+    inline bit::set128 to_set() const { return bit::set128({lo(), hi()}); }
+
+private:
+#if defined(__SSE2__)
+    inline explicit lane(const __m128i v) : _v(v) {}
+    __m128i _v;
+#else
+    words _v;
+#endif
+};
+
+
+/**
+ * @brief Board stored as N digit planes: plane d holds the tiles where digit
+ * d is still possible. Eliminations and inferences work on whole planes, a
+ * handful of AND/OR/ANDNOT per unit instead of a tile-by-tile walk
+ */
+class bitboard final
+{
+public:
+    using dims = utils::dims<BOX>;
+    using trail = q_trail<BOX>;
+    using tile_set = bit::set128;
+    using checkpoint = bitboard;  // Full state, small enough to copy
+
+    bitboard();
+    bitboard(std::string_view grid);
+
+    q_tile<BOX> get_tile(const int index) const;
+
+    bool has_contradiction() const;
+    std::optional<bit::set128> get_candidates() const;
+
+    inline void attach(trail*) {}
+    inline checkpoint save() const { return *this; }
+    inline void restore(const checkpoint& state) { *this = state; }
+
+    std::string serialize() const;
+    bool collapse(const int idx, const int digit);
+
+private:
+    void place(const int idx, const int digit);
+    bool propagate();
+
+    std::array<lane, N> _planes;
+    lane _collapsed;
+};
+
+}  // namespace sudoku
@@ -1,186 +1,106 @@
 #include "board.hpp"
 
-#include <unordered_map>
-#include <sstream>
+#include "stats.hpp"
 
 
-/**
- * @brief Get same column tiles (and cache the result)
- *
- * @param i row id
- * @param j column id
- * @return Array of N-1 column peers
- */
-std::array<int, N - 1> get_col_peers(const int i, const int j)
+namespace sudoku
 {
-    static std::unordered_map<int, std::array<int, N - 1>> cache;
-
-    const int key = utils::grid2array(i, j);
-    if (auto found = cache.find(key); found != cache.end()) {
-        return found->second;
-    }
-
-    std::array<int, N - 1> columns;
-
-    int idx = 0;
-    for (int r = 0; r < N; ++r) {
-        if (r == i) {
-            continue;
-        }
-        columns[idx++] = utils::grid2array(r, j);
-    }
-    return cache[key] = columns;
-}
 
 /**
- * @brief Get same row tiles (and cache the result)
+ * @brief All possible candidates to the tile
  *
- * @param i row id
- * @param j column id
- * @return Array of N-1 row peers
+ * @param possibilities Array filled with the candidates
+ * @return Nb of candidates
  */
-std::array<int, N - 1> get_row_peers(const int i, const int j)
+template <int Box>
+int q_tile<Box>::get_possibilities(std::array<int, dims::n>& possibilities) const
 {
-    static std::unordered_map<int, std::array<int, N - 1>> cache;
-
-    const int key = utils::grid2array(i, j);
-    if (auto found = cache.find(key); found != cache.end()) {
-        return found->second;
-    }
+    int count = 0;
 
-    std::array<int, N - 1> rows;
-
-    int idx = 0;
-    for (int c = 0; c < N; ++c) {
-        if (c == j) {
-            continue;
+    for (int p = 1; p <= dims::n; ++p) {
+        if (is_possible(p)) {
+            possibilities[count++] = p;
         }
-        rows[idx++] = utils::grid2array(i, c);
     }
-    return cache[key] = rows;
+    return count;
 }
 
+
 /**
- * @brief Get same box tiles (and cache the result)
+ * @brief Construct a new q board::q board object
  *
- * @param i row id
- * @param j column id
- * @return Array of N-1 box peers
+ * @param grid A N*N string of digits ('1'-'9' then 'A'-'P') and blank spaces
+ * @param level Inference rules run after each collapse
  */
-std::array<int, N - 1> get_box_peers(const int i, const int j)
+template <int Box>
+q_board<Box>::q_board(std::string_view grid, const inference level) : _level(level)
 {
-    static std::unordered_map<int, std::array<int, N - 1>> cache;
-
-    const int key = utils::grid2array(i, j);
-    if (auto found = cache.find(key); found != cache.end()) {
-        return found->second;
-    }
-
-    std::array<int, N - 1> boxes;
-
-    const int rr = i - (i % BOX);  // = (int)(i / BOX) * BOX
-    const int cc = j - (j % BOX);  // = (int)(j / BOX) * BOX
-
-    int idx = 0;
-    for (int dr = 0; dr < BOX; ++dr) {
-        const int r = rr + dr;
-
-        for (int dc = 0; dc < BOX; ++dc) {
-            const int c = cc + dc;
-
-            if (r == i && c == j) {
-                continue;
-            }
-            boxes[idx++] = utils::grid2array(r, c);
+    for (int idx = 0; idx < dims::tiles; ++idx) {
+        const int i_digit = utils::to_digit(grid[idx]);
+
+        if (i_digit && i_digit <= dims::n && !place(idx, i_digit)) {
+            // Inconsistent clues
+            // Leaves no possibility on the tile so that no search starts
+            update(idx, q_tile<Box>(0));
+            return;
         }
     }
-    return cache[key] = boxes;
-}
-
-
-namespace sudoku
-{
 
-/**
- * @brief Get entropy value
- *
- * @return Entropy
- */
-int q_tile::get_entropy() const
-{
-    if (!(_superposition & init_state))
-        return 0;
-
-    return bit::count(_superposition);
+    if (_level != inference::singles) {
+        reduce();
+    }
 }
 
 /**
- * @brief All possible candidates to the tile
+ * @brief Undoes the changes recorded on the attached trail since mark
  *
- * @return Array of candidates
+ * @param mark Trail size returned by save()
  */
-const std::vector<int> q_tile::get_possibilities() const
+template <int Box>
+void q_board<Box>::restore(const checkpoint mark)
 {
-    std::vector<int> possibilities;
-    possibilities.reserve(N);
-
-    for (int p = 1; p <= N; ++p) {
-        if (is_possible(p)) {
-            possibilities.push_back(p);
-        }
+    while (_trail->size() > mark) {
+        const auto [idx, tile] = _trail->pop();
+        assign(idx, tile);
     }
-    return possibilities;
 }
 
-
 /**
- * @brief Construct a new q board::q board object
+ * @brief Output board
  *
- * @param grid A N*N string of numbers and blank spaces
+ * @return The string format of board
  */
-q_board::q_board(std::string_view grid)
+template <int Box>
+std::string q_board<Box>::serialize() const
 {
-    for (int idx = 0; idx < N * N; ++idx) {
-        const char c_digit = grid[idx];
+    std::string grid(dims::tiles, '.');
 
-        if (c_digit != '.') {
-            const int i_digit = c_digit - '0';
-
-            collapse(idx, i_digit);
+    for (int idx = 0; idx < dims::tiles; ++idx) {
+        if (_grid[idx].has_collapsed()) {
+            grid[idx] = utils::to_char(_grid[idx].get_digit());
         }
     }
+    return grid;
 }
 
 /**
- * @brief Pre-computes col, row and box peers of a tile
- *
- * @param i row id
- * @param j col id
- */
-void q_board::precompute_peers(const int i, const int j)
-{
-    get_col_peers(i, j);
-    get_row_peers(i, j);
-    get_box_peers(i, j);
-}
-
-/**
- * @brief Output board
+ * @brief Sets a tile to a specific value, then runs the inference rules of the
+ * board level
  *
- * @return The string format of board
+ * @param index The tile index
+ * @param digit The chosen value
+ * @return true if tile was set to value,
+ * @return false otherwise
  */
-std::string q_board::serialize() const
+template <int Box>
+bool q_board<Box>::collapse(const int index, const int digit)
 {
-    std::stringstream ss;
-    for (const auto tile : _grid) {
-        if (tile.has_collapsed()) {
-            ss << tile.get_digit();
-
-        } else {
-            ss << '.';
-        }
+    if (!place(index, digit)) {
+        return false;
     }
-    return ss.str();
+
+    // Stronger rules only run once singles are exhausted
+    return _level == inference::singles || reduce();
 }
 
 /**
@@ -192,33 +112,37 @@ std::string q_board::serialize() const
  * @return true if tile was set to value,
  * @return false otherwise
  */
-bool q_board::collapse(const int index, const int digit)
+template <int Box>
+bool q_board<Box>::place(const int index, const int digit)
 {
-    const auto& [i, j] = utils::array2grid(index);
-    q_tile& tile = _grid[index];
+    q_tile<Box> tile = _grid[index];
 
     if (tile.has_collapsed()) {
         // Asserts that collapsed tile has the correct value
         return (tile.get_digit() == digit);
     }
 
+    if (!tile.is_possible(digit)) {
+        // Digit already taken by a peer
+        return false;
+    }
+
     // Sets tile value
     tile.fill(digit);
+    update(index, tile);
 
     // Propagates collapse information
-    if (!propagate_col(i, j, digit)
-        || !propagate_row(i, j, digit)
-        || !propagate_box(i, j, digit))
-    {
-        return false;
+    for (const int idx : peers::lookup<Box>.peers[index]) {
+        if (!propagate(idx, digit)) {
+            return false;
+        }
     }
 
-    // Infers subsequent collapses
-    if (!infer_col(i, j)
-        || !infer_row(i, j)
-        || !infer_box(i, j))
-    {
-        return false;
+    // Infers subsequent collapses on the row, col and box of the tile
+    for (const int unit : peers::lookup<Box>.units_of[index]) {
+        if (!infer(peers::lookup<Box>.units[unit])) {
+            return false;
+        }
     }
 
     return true;
@@ -233,12 +157,19 @@ bool q_board::collapse(const int index, const int digit)
  * @return true if information was properly propagated,
  * @return false otherwise
  */
-bool q_board::propagate(const int idx, const int digit)
+template <int Box>
+bool q_board<Box>::propagate(const int idx, const int digit)
 {
-    q_tile& tile = _grid[idx];
+    q_tile<Box> tile = _grid[idx];
+
+    if (!tile.is_possible(digit)) {
+        // Nothing new to propagate
+        return true;
+    }
 
     // Removes value as possibility
     tile.eliminate(digit);
+    update(idx, tile);
 
     const int entropy = tile.get_entropy();
 
@@ -251,7 +182,8 @@ bool q_board::propagate(const int idx, const int digit)
     // Collapse cascade
     // Tile not set but only has one option
     if (entropy == 1) {
-        return collapse(idx, tile.get_digit());
+        stats::cascade();
+        return place(idx, tile.get_digit());
     }
     return true;
 }
@@ -260,20 +192,21 @@ bool q_board::propagate(const int idx, const int digit)
  * @brief Recursively infers if original collapse forced another collapse to a
  * peer group
  *
- * @param arr Peer group of original tile
+ * @param unit Row, col or box of original tile
  * @return false if inference results in inconsistency,
  * @return true otherwise
  */
-bool q_board::infer(const std::array<int, N - 1>& arr)
+template <int Box>
+bool q_board<Box>::infer(const std::array<peers::index_t<Box>, dims::n>& unit)
 {
     // Checks if there is only one tile that can
     // hold a digit, and sets the digit to the tile
-    for (int d = 1; d <= N; ++d) {
+    for (int d = 1; d <= dims::n; ++d) {
         int inferred_idx = -1;
         bool is_inferred_idx_uniq = false;
 
-        for (const int idx : arr) {
-            const q_tile& tile = _grid[idx];
+        for (const int idx : unit) {
+            const q_tile<Box>& tile = _grid[idx];
 
             if (tile.is_possible(d)) {
                 if (is_inferred_idx_uniq) {
@@ -296,7 +229,8 @@ bool q_board::infer(const std::array<int, N - 1>& arr)
         }
 
         // Checks if inference creates inconsistency
-        if (!collapse(inferred_idx, d)) {
+        stats::cascade();
+        if (!place(inferred_idx, d)) {
             return false;
         }
     }
@@ -304,49 +238,254 @@ bool q_board::infer(const std::array<int, N - 1>& arr)
     return true;
 }
 
-bool q_board::propagate_col(const int i, const int j, const int digit)
+/**
+ * @brief Runs locked candidates and, at the subsets level, naked and hidden
+ * subsets until none of them eliminates anything
+ *
+ * @return false if an elimination results in inconsistency,
+ * @return true otherwise
+ */
+template <int Box>
+bool q_board<Box>::reduce()
 {
-    for (const int idx : get_col_peers(i, j)) {
-        if (!propagate(idx, digit)) {
-            return false;
+    constexpr auto& lookup = peers::lookup<Box>;
+
+    bool changed = true;
+
+    while (changed) {
+        changed = false;
+
+        for (int inter = 0; inter < peers::nb_intersections<Box>; ++inter) {
+            if (!lock(inter, changed)) {
+                return false;
+            }
+        }
+
+        if (_level == inference::subsets) {
+            for (const auto& unit : lookup.units) {
+                if (!naked_subsets(unit, changed) || !hidden_subsets(unit, changed)) {
+                    return false;
+                }
+            }
+        }
+
+        if (!changed) {
+            break;
+        }
+
+        // Eliminations may have left hidden singles in any unit
+        for (const auto& unit : lookup.units) {
+            if (!infer(unit)) {
+                return false;
+            }
         }
     }
+
     return true;
 }
 
-bool q_board::propagate_row(const int i, const int j, const int digit)
+/**
+ * @brief Removes digits from a tile
+ *
+ * @param idx Tile index
+ * @param digits Mask of the digits to remove
+ * @param changed Set if a digit was still possible
+ * @return false if the removal results in inconsistency,
+ * @return true otherwise
+ */
+template <int Box>
+bool q_board<Box>::remove(const int idx, const mask_t digits, bool& changed)
 {
-    for (const int idx : get_row_peers(i, j)) {
-        if (!propagate(idx, digit)) {
+    for (mask_t m = _grid[idx].get_mask() & digits; m; m &= m - 1) {
+        changed = true;
+
+        if (!propagate(idx, bit::lowest(m) + 1)) {
             return false;
         }
     }
     return true;
 }
 
-bool q_board::propagate_box(const int i, const int j, const int digit)
+/**
+ * @brief Locked candidates on the intersection of a box and a line: a digit
+ * of the line only possible in the box leaves the rest of the box (claiming),
+ * a digit of the box only possible on the line leaves the rest of the line
+ * (pointing)
+ *
+ * @param inter Intersection index
+ * @param changed Set if a digit was removed
+ * @return false if inference results in inconsistency,
+ * @return true otherwise
+ */
+template <int Box>
+bool q_board<Box>::lock(const int inter, bool& changed)
 {
-    for (const int idx : get_box_peers(i, j)) {
-        if (!propagate(idx, digit)) {
-            return false;
+    constexpr auto& lookup = peers::lookup<Box>;
+
+    mask_t inter_digits = 0, line_digits = 0, box_digits = 0;
+
+    for (const int idx : lookup.intersections[inter]) {
+        inter_digits |= _grid[idx].get_mask();
+    }
+    for (const int idx : lookup.line_rests[inter]) {
+        line_digits |= _grid[idx].get_mask();
+    }
+    for (const int idx : lookup.box_rests[inter]) {
+        box_digits |= _grid[idx].get_mask();
+    }
+
+    if (const mask_t claiming = inter_digits & ~line_digits) {
+        for (const int idx : lookup.box_rests[inter]) {
+            if (!remove(idx, claiming, changed)) {
+                return false;
+            }
         }
     }
+
+    if (const mask_t pointing = inter_digits & ~box_digits) {
+        for (const int idx : lookup.line_rests[inter]) {
+            if (!remove(idx, pointing, changed)) {
+                return false;
+            }
+        }
+    }
+
     return true;
 }
 
-bool q_board::infer_col(const int i, const int j)
+namespace
+{
+
+/**
+ * @brief Calls f on each pair and triple of sets whose union holds as many
+ * elements as there are sets, e.g. 3 tiles sharing the same 3 digits
+ *
+ * @param sets Sets of 2 or 3 elements, empty ones being skipped
+ * @param f Callable taking the mask of the chosen sets and their union,
+ * returning false to stop
+ * @return false if f stopped,
+ * @return true otherwise
+ */
+template <typename Mask, std::size_t Size, typename F>
+bool for_each_subset(const std::array<Mask, Size>& sets, F f)
 {
-    return infer(get_col_peers(i, j));
+    for (std::size_t a = 0; a < Size; ++a) {
+        if (!sets[a]) {
+            continue;
+        }
+
+        for (std::size_t b = a + 1; b < Size; ++b) {
+            if (!sets[b]) {
+                continue;
+            }
+
+            const Mask pair = sets[a] | sets[b];
+            const int nb_pair = bit::count(pair);
+
+            if (nb_pair == 2 && !f((1u << a) | (1u << b), pair)) {
+                return false;
+            }
+            if (nb_pair != 3) {
+                continue;
+            }
+
+            for (std::size_t c = b + 1; c < Size; ++c) {
+                const Mask triple = pair | sets[c];
+
+                if (sets[c] && bit::count(triple) == 3 && !f((1u << a) | (1u << b) | (1u << c), triple)) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
 }
 
-bool q_board::infer_row(const int i, const int j)
+}  // namespace
+
+/**
+ * @brief Naked pairs and triples: k tiles of a unit holding only the same k
+ * digits remove these digits from the other tiles of the unit
+ *
+ * @param unit Row, col or box
+ * @param changed Set if a digit was removed
+ * @return false if inference results in inconsistency,
+ * @return true otherwise
+ */
+template <int Box>
+bool q_board<Box>::naked_subsets(const std::array<peers::index_t<Box>, dims::n>& unit, bool& changed)
 {
-    return infer(get_row_peers(i, j));
+    std::array<mask_t, dims::n> digits;
+
+    for (int k = 0; k < dims::n; ++k) {
+        const q_tile<Box>& tile = _grid[unit[k]];
+        const int entropy = tile.get_entropy();
+
+        digits[k] = (!tile.has_collapsed() && entropy >= 2 && entropy <= 3) ? tile.get_mask() : 0;
+    }
+
+    return for_each_subset(digits, [&](const uint32_t members, const mask_t subset) {
+        for (int k = 0; k < dims::n; ++k) {
+            if (!bit::check(members, k) && !remove(unit[k], subset, changed)) {
+                return false;
+            }
+        }
+        return true;
+    });
 }
 
-bool q_board::infer_box(const int i, const int j)
+/**
+ * @brief Hidden pairs and triples: k digits only possible on the same k tiles
+ * of a unit remove the other digits from these tiles
+ *
+ * @param unit Row, col or box
+ * @param changed Set if a digit was removed
+ * @return false if inference results in inconsistency,
+ * @return true otherwise
+ */
+template <int Box>
+bool q_board<Box>::hidden_subsets(const std::array<peers::index_t<Box>, dims::n>& unit, bool& changed)
 {
-    return infer(get_box_peers(i, j));
+    // Positions in the unit of each digit
+    std::array<uint32_t, dims::n> places{};
+
+    for (int k = 0; k < dims::n; ++k) {
+        const q_tile<Box>& tile = _grid[unit[k]];
+
+        if (tile.has_collapsed()) {
+            continue;
+        }
+        for (mask_t m = tile.get_mask(); m; m &= m - 1) {
+            places[bit::lowest(m)] |= 1u << k;
+        }
+    }
+
+    for (uint32_t& p : places) {
+        if (bit::count(p) > 3) {
+            p = 0;
+        }
+    }
+
+    return for_each_subset(places, [&](const uint32_t digits, const uint32_t positions) {
+        const mask_t others = init_state<Box> & ~digits;
+
+        for (uint32_t p = positions; p; p &= p - 1) {
+            if (!remove(unit[bit::lowest(p)], others, changed)) {
+                return false;
+            }
+        }
+        return true;
+    });
 }
 
+template class q_tile<2>;
+template class q_tile<3>;
+template class q_tile<4>;
+template class q_tile<5>;
+
+template class q_board<2>;
+template class q_board<3>;
+template class q_board<4>;
+template class q_board<5>;
+
 }  // namespace sudoku
@@ -1,62 +1,217 @@
 #pragma once
 
 #include <array>
-#include <vector>
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
 
 #include "bit_manipulation.hpp"
+#include "peers.hpp"
 #include "utils.hpp"
 
 
 namespace sudoku
 {
 
-inline constexpr int16_t init_state = 0b01'1111'1111;
+/**
+ * @brief All the N possibilities of a tile
+ */
+template <int Box>
+inline constexpr typename utils::dims<Box>::mask_t init_state = (1u << utils::dims<Box>::n) - 1;
+
+/**
+ * @brief Inference rules run after each collapse, each level adding to the
+ * previous ones
+ */
+enum class inference {
+    singles,  // Naked and hidden singles
+    locked,   // Locked candidates: pointing and claiming between boxes and lines
+    subsets,  // Naked and hidden pairs and triples
+};
+
 
+/**
+ * @brief Superposition of the possible digits of a tile, bit N marking a
+ * collapsed tile
+ */
+template <int Box>
 class q_tile final
 {
 public:
-    inline bool has_collapsed() const { return bit::check(_superposition, N); }
+    using dims = utils::dims<Box>;
+    using mask_t = typename dims::mask_t;
+
+    q_tile() = default;
+    inline explicit q_tile(const mask_t superposition) : _superposition(superposition) {}
+
+    inline bool has_collapsed() const { return bit::check(_superposition, dims::n); }
 
-    inline int get_digit() const { return bit::mask.at(_superposition); }
-    int get_entropy() const;
+    inline int get_digit() const { return bit::lowest(_superposition) + 1; }
+    inline int get_entropy() const { return (_superposition & init_state<Box>) ? bit::count(_superposition) : 0; }
 
     inline bool is_possible(const int digit) const { return bit::check(_superposition, digit - 1); }
-    const std::vector<int> get_possibilities() const;
+    inline mask_t get_mask() const { return _superposition & init_state<Box>; }
+    int get_possibilities(std::array<int, dims::n>& possibilities) const;
 
-    inline void fill(const int digit) { _superposition = bit::set(1 << N, digit - 1); }
+    inline void fill(const int digit) { _superposition = bit::set(mask_t(mask_t{1} << dims::n), digit - 1); }
     inline void eliminate(const int digit) { _superposition = bit::clear(_superposition, digit - 1); }
 
 private:
-    int16_t _superposition = init_state;
+    mask_t _superposition = init_state<Box>;
+};
+
+
+/**
+ * @brief Undo log of tile changes, so that a board can go back to an earlier
+ * state without being copied
+ */
+template <int Box>
+class q_trail final
+{
+public:
+    using dims = utils::dims<Box>;
+
+    struct entry {
+        peers::index_t<Box> index;
+        q_tile<Box> tile;
+    };
+
+    inline std::size_t size() const { return _size; }
+    inline void push(const int index, const q_tile<Box> tile) { _entries[_size++] = {static_cast<peers::index_t<Box>>(index), tile}; }
+    inline entry pop() { return _entries[--_size]; }
+
+private:
+    // Along a search path a tile changes at most N + 2 times:
+    // each elimination, its fill and the elimination of its own digit
+    std::array<entry, dims::tiles * (dims::n + 2)> _entries;
+    std::size_t _size = 0;
 };
 
 
+/**
+ * @brief Uncollapsed tiles grouped by entropy, all N possibilities at start
+ */
+template <int Box>
+inline constexpr auto init_entropies = [] {
+    using dims = utils::dims<Box>;
+
+    std::array<bit::index_set<dims::tiles>, dims::n + 1> entropies{};
+    for (int idx = 0; idx < dims::tiles; ++idx) {
+        entropies[dims::n].insert(idx);
+    }
+    return entropies;
+}();
+
+
+template <int Box>
 class q_board final
 {
 public:
+    using dims = utils::dims<Box>;
+    using trail = q_trail<Box>;
+    using tile_set = bit::index_set<dims::tiles>;
+    using checkpoint = std::size_t;  // Trail size
+
     q_board() = default;
-    q_board(std::string_view grid);
+    q_board(std::string_view grid, const inference level = inference::singles);
+
+    inline const std::array<q_tile<Box>, dims::tiles>& get_grid() const { return _grid; }
+    inline const q_tile<Box>& get_tile(const int index) const { return _grid[index]; }
 
-    inline const std::array<q_tile, N * N>& get_grid() const { return _grid; }
-    inline const q_tile& get_tile(const int index) const { return _grid[index]; }
+    inline bool has_contradiction() const { return _entropies[0].any(); }
+    inline const tile_set& get_tiles(const int entropy) const { return _entropies[entropy]; }
+    std::optional<tile_set> get_candidates() const;
 
-    static void precompute_peers(const int i, const int j);
+    inline void attach(trail* t) { _trail = t; }
+    inline checkpoint save() const { return _trail->size(); }
+    void restore(const checkpoint mark);
 
     std::string serialize() const;
     bool collapse(const int idx, const int digit);
 
 private:
+    using mask_t = typename dims::mask_t;
+
+    void assign(const int idx, const q_tile<Box> tile);
+    void update(const int idx, const q_tile<Box> tile);
+
+    bool place(const int index, const int digit);
     bool propagate(const int idx, const int digit);
-    bool propagate_col(const int i, const int j, const int digit);
-    bool propagate_row(const int i, const int j, const int digit);
-    bool propagate_box(const int i, const int j, const int digit);
+    bool infer(const std::array<peers::index_t<Box>, dims::n>& unit);
+
+    bool reduce();
+    bool remove(const int idx, const mask_t digits, bool& changed);
+    bool lock(const int inter, bool& changed);
+    bool naked_subsets(const std::array<peers::index_t<Box>, dims::n>& unit, bool& changed);
+    bool hidden_subsets(const std::array<peers::index_t<Box>, dims::n>& unit, bool& changed);
 
-    bool infer(const std::array<int, N - 1>& arr);
-    bool infer_col(const int i, const int j);
-    bool infer_row(const int i, const int j);
-    bool infer_box(const int i, const int j);
+    friend struct board_probe;  // Benchmarks of the private steps
 
-    std::array<q_tile, N * N> _grid;
+    std::array<q_tile<Box>, dims::tiles> _grid;
+    std::array<tile_set, dims::n + 1> _entropies = init_entropies<Box>;
+    trail* _trail = nullptr;  // Records changes when attached
+    inference _level = inference::singles;
 };
 
+/**
+ * @brief Overwrites a tile and moves it to the entropy set it now belongs to
+ *
+ * @param idx Tile index
+ * @param tile New tile state
+ */
+template <int Box>
+inline void q_board<Box>::assign(const int idx, const q_tile<Box> tile)
+{
+    const q_tile<Box> old = _grid[idx];
+
+    if (!old.has_collapsed()) {
+        _entropies[old.get_entropy()].erase(idx);
+    }
+    if (!tile.has_collapsed()) {
+        _entropies[tile.get_entropy()].insert(idx);
+    }
+    _grid[idx] = tile;
+}
+
+/**
+ * @brief Changes a tile, recording its previous state if a trail is attached
+ *
+ * @param idx Tile index
+ * @param tile New tile state
+ */
+template <int Box>
+inline void q_board<Box>::update(const int idx, const q_tile<Box> tile)
+{
+    if (_trail) {
+        _trail->push(idx, _grid[idx]);
+    }
+    assign(idx, tile);
+}
+
+/**
+ * @brief Get the tiles with minimal entropy, read from the entropy sets the
+ * board keeps up to date
+ *
+ * @return std::optional set of tiles, empty if all tiles have collapsed
+ * (i.e. is a solution)
+ */
+template <int Box>
+inline auto q_board<Box>::get_candidates() const -> std::optional<tile_set>
+{
+    if (has_contradiction()) {
+        // No solution possible
+        // due to a conflict of collapsed tiles
+        return std::nullopt;
+    }
+
+    for (int entropy = 1; entropy <= dims::n; ++entropy) {
+        if (const tile_set& tiles = _entropies[entropy]; tiles.any()) {
+            return tiles;
+        }
+    }
+
+    return tile_set{};
+}
+
 }  // namespace sudoku
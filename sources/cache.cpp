@@ -0,0 +1,120 @@
+#include "cache.hpp"
+
+#include <algorithm>
+#include <functional>
+
+
+namespace cache
+{
+
+namespace
+{
+
+// Bookkeeping of an entry besides its strings: list node, hash node, bucket
+constexpr std::size_t entry_overhead = 2 * sizeof(std::string) + 96;
+
+inline std::size_t size_of(std::string_view key, std::string_view value)
+{
+    return key.size() + value.size() + entry_overhead;
+}
+
+}  // namespace
+
+
+/**
+ * @brief Construct a new lru object
+ *
+ * @param budget Memory budget in bytes, shared evenly by the shards
+ * @param nb_shards Nb of independently locked shards
+ */
+lru::lru(const std::size_t budget, const std::size_t nb_shards)
+    : _shard_budget(budget / std::max<std::size_t>(1, nb_shards)),
+      _shards(std::max<std::size_t>(1, nb_shards))
+{
+}
+
+/**
+ * @brief Looks a key up, marking it as the most recently used
+ *
+ * @param key Key
+ * @return Copy of the value, empty if the key is missing
+ */
+std::optional<std::string> lru::find(std::string_view key)
+{
+    shard& s = shard_of(key);
+    std::scoped_lock lock(s.mtx);
+
+    const auto it = s.index.find(key);
+
+    if (it == s.index.end()) {
+        s.stats.misses++;
+        return std::nullopt;
+    }
+
+    s.stats.hits++;
+    s.entries.splice(s.entries.begin(), s.entries, it->second);
+    return it->second->second;
+}
+
+/**
+ * @brief Adds a key, evicting the least recently used keys of its shard
+ * beyond the budget. An existing key keeps its value
+ *
+ * @param key Key
+ * @param value Value
+ */
+void lru::insert(std::string_view key, std::string_view value)
+{
+    const std::size_t size = size_of(key, value);
+
+    shard& s = shard_of(key);
+    std::scoped_lock lock(s.mtx);
+
+    if (size > _shard_budget || s.index.contains(key)) {
+        return;
+    }
+
+    while (s.stats.bytes + size > _shard_budget) {
+        const entry& last = s.entries.back();
+
+        s.stats.bytes -= size_of(last.first, last.second);
+        s.stats.evictions++;
+        s.index.erase(last.first);
+        s.entries.pop_back();
+    }
+
+    s.entries.emplace_front(key, value);
+    s.index.emplace(s.entries.front().first, s.entries.begin());
+
+    s.stats.bytes += size;
+    s.stats.insertions++;
+}
+
+/**
+ * @brief Sums the counters of all shards
+ *
+ * @return Counters
+ */
+lru::counters lru::get_counters() const
+{
+    counters total;
+
+    for (const shard& s : _shards) {
+        std::scoped_lock lock(s.mtx);
+
+        total.hits += s.stats.hits;
+        total.misses += s.stats.misses;
+        total.insertions += s.stats.insertions;
+        total.evictions += s.stats.evictions;
+        total.bytes += s.stats.bytes;
+        total.entries += s.entries.size();
+    }
+    return total;
+}
+
+lru::shard& lru::shard_of(std::string_view key)
+{
+    return _shards[std::hash<std::string_view>{}(key) % _shards.size()];
+}
+
+}  // namespace cache
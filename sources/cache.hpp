@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+
+namespace cache
+{
+
+/**
+ * @brief Least recently used map of strings under a memory budget, split
+ * into shards locked independently so that workers rarely wait on each other
+ */
+class lru final
+{
+public:
+    struct counters {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t insertions = 0;
+        uint64_t evictions = 0;
+        std::size_t entries = 0;
+        std::size_t bytes = 0;
+    };
+
+    explicit lru(const std::size_t budget, const std::size_t nb_shards = 16);
+
+    std::optional<std::string> find(std::string_view key);
+    void insert(std::string_view key, std::string_view value);
+
+    counters get_counters() const;
+
+private:
+    using entry = std::pair<std::string, std::string>;
+
+    struct alignas(64) shard {
+        mutable std::mutex mtx;
+        std::list<entry> entries;  // Most recently used first
+        std::unordered_map<std::string_view, std::list<entry>::iterator> index;  // Keys point into entries
+        counters stats;
+    };
+
+    shard& shard_of(std::string_view key);
+
+    std::size_t _shard_budget;  // Bytes per shard
+    std::vector<shard> _shards;
+};
+
+}  // namespace cache
@@ -0,0 +1,288 @@
+#include "canon.hpp"
+
+#include <algorithm>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+
+namespace canon
+{
+
+namespace
+{
+
+/**
+ * @brief Order of the lines of one axis: bands (or stacks) first, then the
+ * rows (or cols) inside each band
+ */
+template <int Box>
+struct axis {
+    std::array<uint8_t, Box> groups;                   // Band of each position
+    std::array<std::array<uint8_t, Box>, Box> lines;   // Local row of each position, per band
+
+    inline uint8_t line(const int pos) const
+    {
+        const int g = groups[pos / Box];
+        return g * Box + lines[g][pos % Box];
+    }
+};
+
+/**
+ * @brief Digit of a tile, digits too large for the grid being blanks as for
+ * the boards
+ *
+ * @param c Character
+ * @return Digit, 0 for a blank
+ */
+template <int Box>
+inline int digit_of(const char c)
+{
+    const int d = utils::to_digit(c);
+    return d <= utils::dims<Box>::n ? d : 0;
+}
+
+// Run of positions whose keys are equal, hence every ordering must be tried
+using tie = std::pair<uint8_t*, uint8_t*>;
+
+/**
+ * @brief Sorts items by decreasing key, keeping ties in increasing order, and
+ * records the runs of ties
+ *
+ * @param items Items to sort
+ * @param key Callable giving the key of an item
+ * @param ties Runs of ties, appended to
+ */
+template <std::size_t Size, typename Key>
+void sort_by_key(std::array<uint8_t, Size>& items, Key key, std::vector<tie>& ties)
+{
+    std::iota(items.begin(), items.end(), 0);
+    std::stable_sort(items.begin(), items.end(), [&](const uint8_t a, const uint8_t b) {
+        return key(a) > key(b);
+    });
+
+    for (std::size_t begin = 0, end = 1; begin < Size; begin = end++) {
+        while (end < Size && key(items[end]) == key(items[begin])) {
+            ++end;
+        }
+        if (end - begin > 1) {
+            ties.emplace_back(items.data() + begin, items.data() + end);
+        }
+    }
+}
+
+/**
+ * @brief Orders the lines of one axis by keys that no symmetry keeping the
+ * axis changes: the nb of clues of the line, then the nb of clues of the line
+ * in each box, regardless of the box order
+ *
+ * @param digits Digits of the grid, lines being rows
+ * @param a Axis filled with the order
+ * @param ties Runs of ties, appended to
+ */
+template <int Box>
+void order_axis(const std::array<int, utils::dims<Box>::tiles>& digits, axis<Box>& a, std::vector<tie>& ties)
+{
+    constexpr int n = utils::dims<Box>::n;
+
+    std::array<uint64_t, n> line_keys;
+
+    for (int l = 0; l < n; ++l) {
+        std::array<int, Box> per_box{};
+        int total = 0;
+
+        for (int k = 0; k < n; ++k) {
+            const bool clue = digits[l * n + k] != 0;
+            per_box[k / Box] += clue;
+            total += clue;
+        }
+
+        std::sort(per_box.begin(), per_box.end(), std::greater<>());
+
+        uint64_t key = total;
+        for (const int c : per_box) {
+            key = key * (n + 1) + c;
+        }
+        line_keys[l] = key;
+    }
+
+    std::array<std::array<uint64_t, Box>, Box> group_keys;
+
+    for (int g = 0; g < Box; ++g) {
+        for (int k = 0; k < Box; ++k) {
+            group_keys[g][k] = line_keys[g * Box + k];
+        }
+        std::sort(group_keys[g].begin(), group_keys[g].end(), std::greater<>());
+
+        sort_by_key(a.lines[g], [&](const uint8_t k) { return line_keys[g * Box + k]; }, ties);
+    }
+
+    sort_by_key(a.groups, [&](const uint8_t g) { return group_keys[g]; }, ties);
+}
+
+/**
+ * @brief Moves to the next ordering of the ties, as an odometer
+ *
+ * @param ties Runs of ties
+ * @return false once all orderings were visited
+ */
+bool next_ordering(const std::vector<tie>& ties)
+{
+    for (const auto& [begin, end] : ties) {
+        if (std::next_permutation(begin, end)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+}  // namespace
+
+
+/**
+ * @brief Maps a grid of the source to the canonical grid
+ *
+ * @param grid Source grid, puzzle or solution
+ * @return Transformed grid
+ */
+template <int Box>
+std::string transform<Box>::apply(std::string_view grid) const
+{
+    constexpr int n = dims::n;
+    std::string out(dims::tiles, '.');
+
+    for (int r = 0; r < n; ++r) {
+        for (int c = 0; c < n; ++c) {
+            const int idx = transposed ? cols[c] * n + rows[r] : rows[r] * n + cols[c];
+            out[r * n + c] = utils::to_char(labels[digit_of<Box>(grid[idx])]);
+        }
+    }
+    return out;
+}
+
+/**
+ * @brief Maps a canonical grid back to the source
+ *
+ * @param grid Canonical grid, puzzle or solution
+ * @return Grid in the source layout and digits
+ */
+template <int Box>
+std::string transform<Box>::revert(std::string_view grid) const
+{
+    constexpr int n = dims::n;
+
+    std::array<uint8_t, n + 1> sources{};
+    for (int d = 0; d <= n; ++d) {
+        sources[labels[d]] = d;
+    }
+
+    std::string out(dims::tiles, '.');
+
+    for (int r = 0; r < n; ++r) {
+        for (int c = 0; c < n; ++c) {
+            const int idx = transposed ? cols[c] * n + rows[r] : rows[r] * n + cols[c];
+            out[idx] = utils::to_char(sources[digit_of<Box>(grid[r * n + c])]);
+        }
+    }
+    return out;
+}
+
+/**
+ * @brief Finds the canonical form of a puzzle: lines are ordered by their
+ * clue counts, every ordering of the lines that cannot be told apart is
+ * tried, digits are relabelled in order of appearance, and the smallest grid
+ * wins
+ *
+ * @param grid Puzzle
+ * @param budget Max nb of orderings tried per orientation
+ * @return Canonical grid and the symmetry leading to it
+ */
+template <int Box>
+form<Box> canonicalize(std::string_view grid, const std::size_t budget)
+{
+    using dims = utils::dims<Box>;
+    constexpr int n = dims::n;
+
+    std::array<int, dims::tiles> source;
+    for (int idx = 0; idx < dims::tiles; ++idx) {
+        source[idx] = digit_of<Box>(grid[idx]);
+    }
+
+    form<Box> best{std::string(dims::tiles, '~'), {}};
+    std::string candidate(dims::tiles, '.');
+
+    for (const bool transposed : {false, true}) {
+        std::array<int, dims::tiles> digits, flipped;
+
+        for (int r = 0; r < n; ++r) {
+            for (int c = 0; c < n; ++c) {
+                digits[r * n + c] = transposed ? source[c * n + r] : source[r * n + c];
+                flipped[c * n + r] = digits[r * n + c];
+            }
+        }
+
+        axis<Box> rows, cols;
+        std::vector<tie> ties;
+        order_axis<Box>(digits, rows, ties);
+        order_axis<Box>(flipped, cols, ties);
+
+        std::size_t tried = 0;
+
+        do {
+            // Relabels digits in order of appearance, stopping as soon as the
+            // candidate is larger than the best grid
+            std::array<uint8_t, n + 1> labels{};
+            int next_label = 1;
+            bool smaller = false;
+            bool larger = false;
+
+            for (int idx = 0; idx < dims::tiles && !larger; ++idx) {
+                const int d = digits[rows.line(idx / n) * n + cols.line(idx % n)];
+
+                if (d && !labels[d]) {
+                    labels[d] = next_label++;
+                }
+                candidate[idx] = utils::to_char(labels[d]);
+
+                if (!smaller && candidate[idx] != best.grid[idx]) {
+                    smaller = candidate[idx] < best.grid[idx];
+                    larger = !smaller;
+                }
+            }
+
+            if (!smaller) {
+                continue;
+            }
+
+            best.grid = candidate;
+            best.map.transposed = transposed;
+            for (int p = 0; p < n; ++p) {
+                best.map.rows[p] = rows.line(p);
+                best.map.cols[p] = cols.line(p);
+            }
+
+            // Digits without clue take the labels left, in order
+            for (int d = 1; d <= n; ++d) {
+                if (!labels[d]) {
+                    labels[d] = next_label++;
+                }
+            }
+            best.map.labels = labels;
+
+        } while (++tried < budget && next_ordering(ties));
+    }
+
+    return best;
+}
+
+template struct transform<2>;
+template struct transform<3>;
+template struct transform<4>;
+template struct transform<5>;
+
+template form<2> canonicalize<2>(std::string_view, const std::size_t);
+template form<3> canonicalize<3>(std::string_view, const std::size_t);
+template form<4> canonicalize<4>(std::string_view, const std::size_t);
+template form<5> canonicalize<5>(std::string_view, const std::size_t);
+
+}  // namespace canon
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "utils.hpp"
+
+
+/**
+ * @brief Canonical form of a puzzle under the symmetries of the grid: digit
+ * relabelling, row and col permutations within bands and stacks, band and
+ * stack permutations, and transposition. Equivalent puzzles share the same
+ * form, which maps the solution of one onto the others
+ */
+namespace canon
+{
+
+/**
+ * @brief Symmetry taking a grid to its canonical form
+ */
+template <int Box>
+struct transform {
+    using dims = utils::dims<Box>;
+
+    bool transposed = false;                  // Source is read transposed
+    std::array<uint8_t, dims::n> rows{};      // Source row of each row
+    std::array<uint8_t, dims::n> cols{};      // Source col of each col
+    std::array<uint8_t, dims::n + 1> labels{};  // New digit of each source digit, blank kept as 0
+
+    std::string apply(std::string_view grid) const;
+    std::string revert(std::string_view grid) const;
+};
+
+template <int Box>
+struct form {
+    std::string grid;    // Canonical puzzle
+    transform<Box> map;  // From the puzzle to the canonical puzzle
+};
+
+/**
+ * @brief Max nb of orderings tried among rows, cols, bands and stacks that
+ * cannot be told apart. Beyond it the form stays a valid symmetry of the
+ * puzzle but equivalent puzzles may get different forms
+ */
+inline constexpr std::size_t default_budget = 4096;
+
+template <int Box>
+form<Box> canonicalize(std::string_view grid, const std::size_t budget = default_budget);
+
+}  // namespace canon
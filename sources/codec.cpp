@@ -0,0 +1,229 @@
+#include "codec.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+namespace codec
+{
+
+namespace
+{
+
+constexpr std::size_t flush_size = 1 << 20;
+
+inline uint8_t to_nibble(const char c) { return (c >= '1' && c <= '0' + N) ? c - '0' : 0; }
+inline char to_char(const uint8_t nibble) { return nibble ? '0' + nibble : '.'; }
+
+}  // namespace
+
+
+/**
+ * @brief Packs a grid in a record, 32 tiles at a time with SSE2
+ *
+ * @param grid A N*N string of numbers and blank spaces
+ * @param record Pointer to record_size bytes
+ */
+void encode(std::string_view grid, uint8_t* record)
+{
+    std::size_t idx = 0;
+
+#if defined(__SSE2__)
+    const __m128i zero = _mm_set1_epi8('0');
+    const __m128i ten = _mm_set1_epi8(10);
+    const __m128i low_byte = _mm_set1_epi16(0x00FF);
+
+    for (; idx + 32 <= N * N; idx += 32) {
+        __m128i packed[2];
+
+        for (int h = 0; h < 2; ++h) {
+            const __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(grid.data() + idx + 16 * h));
+
+            // Digits in [1, 9], anything else is blank
+            const __m128i digits = _mm_sub_epi8(chars, zero);
+            const __m128i valid = _mm_and_si128(_mm_cmpgt_epi8(digits, _mm_setzero_si128()),
+                                                _mm_cmplt_epi8(digits, ten));
+            const __m128i nibbles = _mm_and_si128(digits, valid);
+
+            // Even tile in the low nibble, odd tile in the high one
+            const __m128i even = _mm_and_si128(nibbles, low_byte);
+            const __m128i odd = _mm_srli_epi16(nibbles, 8);
+            packed[h] = _mm_or_si128(even, _mm_slli_epi16(odd, 4));
+        }
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(record + idx / 2), _mm_packus_epi16(packed[0], packed[1]));
+    }
+#endif
+
+    for (; idx < N * N; idx += 2) {
+        const uint8_t hi = (idx + 1 < N * N) ? to_nibble(grid[idx + 1]) : 0;
+        record[idx / 2] = to_nibble(grid[idx]) | (hi << 4);
+    }
+}
+
+/**
+ * @brief Unpacks a record in a grid, 32 tiles at a time with SSE2
+ *
+ * @param record Pointer to record_size bytes
+ * @param grid Pointer to N*N characters
+ */
+void decode(const uint8_t* record, char* grid)
+{
+    std::size_t idx = 0;
+
+#if defined(__SSE2__)
+    const __m128i zero = _mm_set1_epi8('0');
+    const __m128i blank = _mm_set1_epi8('.');
+    const __m128i low_nibble = _mm_set1_epi8(0x0F);
+
+    for (; idx + 32 <= N * N; idx += 32) {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(record + idx / 2));
+
+        const __m128i lo = _mm_and_si128(bytes, low_nibble);
+        const __m128i hi = _mm_and_si128(_mm_srli_epi16(bytes, 4), low_nibble);
+        const __m128i nibbles[2] = {_mm_unpacklo_epi8(lo, hi), _mm_unpackhi_epi8(lo, hi)};
+
+        for (int h = 0; h < 2; ++h) {
+            const __m128i is_blank = _mm_cmpeq_epi8(nibbles[h], _mm_setzero_si128());
+            const __m128i chars = _mm_or_si128(_mm_and_si128(is_blank, blank),
+                                               _mm_andnot_si128(is_blank, _mm_add_epi8(nibbles[h], zero)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(grid + idx + 16 * h), chars);
+        }
+    }
+#endif
+
+    for (; idx < N * N; ++idx) {
+        const uint8_t byte = record[idx / 2];
+        grid[idx] = to_char((idx & 1) ? (byte >> 4) : (byte & 0x0F));
+    }
+}
+
+/**
+ * @brief FNV-1a hash of records
+ *
+ * @param records Bytes to hash
+ * @param hash Hash of the preceding bytes, if any
+ * @return Hash
+ */
+uint64_t checksum(std::span<const uint8_t> records, uint64_t hash)
+{
+    for (const uint8_t byte : records) {
+        hash = (hash ^ byte) * 0x0000'0100'0000'01B3;
+    }
+    return hash;
+}
+
+/**
+ * @brief Checks the magic number of data
+ *
+ * @param data File content
+ * @return true if data is in the binary format
+ */
+bool is_binary(std::string_view data)
+{
+    return data.size() >= magic.size() && std::equal(magic.begin(), magic.end(), data.begin());
+}
+
+
+/**
+ * @brief Construct a new reader object over a whole binary file. An invalid
+ * or truncated file reads as empty
+ *
+ * @param data File content
+ */
+reader::reader(std::string_view data)
+{
+    if (data.size() < sizeof(header) || !is_binary(data)) {
+        return;
+    }
+
+    header h;
+    std::memcpy(&h, data.data(), sizeof(header));
+
+    if (h.version != version || h.tiles != N * N
+        || h.count > (data.size() - sizeof(header)) / record_size)
+    {
+        return;
+    }
+
+    _records = reinterpret_cast<const uint8_t*>(data.data()) + sizeof(header);
+    _count = h.count;
+    _checksum = h.checksum;
+}
+
+/**
+ * @brief Checks the records against the checksum of the header
+ *
+ * @return true if records are intact
+ */
+bool reader::verify() const
+{
+    return _records && checksum({_records, _count * record_size}) == _checksum;
+}
+
+
+/**
+ * @brief Construct a new writer object, reserving room for the header
+ *
+ * @param path Path to output file
+ */
+writer::writer(const std::filesystem::path& path)
+    : _file(path, std::ios::binary | std::ios::trunc), _checksum(checksum({}))
+{
+    const header h{};
+    _file.write(reinterpret_cast<const char*>(&h), sizeof(header));
+    _buffer.reserve(flush_size + record_size);
+}
+
+writer::~writer()
+{
+    close();
+}
+
+/**
+ * @brief Appends a grid
+ *
+ * @param grid A N*N string of numbers and blank spaces
+ */
+void writer::write(std::string_view grid)
+{
+    const std::size_t size = _buffer.size();
+    _buffer.resize(size + record_size);
+    encode(grid, _buffer.data() + size);
+    _count++;
+
+    if (_buffer.size() >= flush_size) {
+        flush();
+    }
+}
+
+void writer::flush()
+{
+    _checksum = checksum(_buffer, _checksum);
+    _file.write(reinterpret_cast<const char*>(_buffer.data()), _buffer.size());
+    _buffer.clear();
+}
+
+/**
+ * @brief Flushes the records and writes the header
+ *
+ */
+void writer::close()
+{
+    if (!_file.is_open()) {
+        return;
+    }
+
+    flush();
+
+    const header h{magic, version, N * N, _count, _checksum};
+    _file.seekp(0);
+    _file.write(reinterpret_cast<const char*>(&h), sizeof(header));
+    _file.close();
+}
+
+}  // namespace codec
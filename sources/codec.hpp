@@ -0,0 +1,88 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "utils.hpp"
+
+
+/**
+ * @brief Packed binary format for batches of grids (puzzles or solutions):
+ * a header followed by fixed-size records of 4 bits per tile, 0 for a blank
+ * tile and the digit otherwise, two tiles per byte (low nibble first)
+ */
+namespace codec
+{
+
+inline constexpr std::array<char, 4> magic = {'W', 'F', 'C', 'B'};
+inline constexpr uint16_t version = 1;
+inline constexpr std::size_t record_size = (N * N + 1) / 2;
+
+static_assert(N < 16, "Tiles are packed on 4 bits");
+
+struct header {
+    std::array<char, 4> magic;
+    uint16_t version;
+    uint16_t tiles;     // Tiles per record
+    uint64_t count;     // Nb of records
+    uint64_t checksum;  // FNV-1a of the records
+};
+
+static_assert(sizeof(header) == 24, "Unexpected header padding");
+
+void encode(std::string_view grid, uint8_t* record);
+void decode(const uint8_t* record, char* grid);
+uint64_t checksum(std::span<const uint8_t> records, uint64_t hash = 0xCBF2'9CE4'8422'2325);
+
+bool is_binary(std::string_view data);
+
+/**
+ * @brief Random access to the records of a binary file in memory
+ */
+class reader final
+{
+public:
+    explicit reader(std::string_view data);
+
+    inline std::size_t size() const { return _count; }
+    inline std::size_t offset(const std::size_t index) const { return sizeof(header) + index * record_size; }
+
+    bool verify() const;
+    inline void get(const std::size_t index, char* grid) const { decode(_records + index * record_size, grid); }
+
+private:
+    const uint8_t* _records = nullptr;
+    std::size_t _count = 0;
+    uint64_t _checksum = 0;
+};
+
+/**
+ * @brief Appends records to a binary file, the header being written on close
+ */
+class writer final
+{
+public:
+    explicit writer(const std::filesystem::path& path);
+    ~writer();
+
+    inline bool is_open() const { return _file.is_open(); }
+
+    void write(std::string_view grid);
+    void close();
+
+private:
+    void flush();
+
+    std::ofstream _file;
+    std::vector<uint8_t> _buffer;
+    uint64_t _count = 0;
+    uint64_t _checksum;
+};
+
+}  // namespace codec
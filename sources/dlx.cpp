@@ -0,0 +1,411 @@
+#include "dlx.hpp"
+
+#include <array>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#include "limits.hpp"
+#include "stats.hpp"
+#include "utils.hpp"
+
+
+namespace sudoku
+{
+
+namespace
+{
+
+/**
+ * @brief Dancing links of one size of grid: four nodes per row (tile, digit),
+ * one per constraint it satisfies, followed by a header node per constraint.
+ * Rows never change their horizontal links, so those are implied by the node
+ * index, and only the column lists and the list of headers are updated.
+ * Covering is undone in reverse order, which brings the links back to their
+ * initial state after each puzzle
+ */
+template <int Box>
+class arena
+{
+public:
+    arena();
+
+    bool place(const std::string& board);
+    int search(limits& lim, const int limit, std::string& board, wfc::status& result);
+    void reset();
+
+private:
+    using dims = utils::dims<Box>;
+
+    static constexpr int n = dims::n;
+    static constexpr int nb_rows = dims::tiles * n;
+    static constexpr int nb_cols = 4 * dims::tiles;  // Tiles, then digits of the rows, cols and boxes
+    static constexpr int headers = 4 * nb_rows;      // Node of the first header
+    static constexpr int root = nb_cols;             // Column before the first and after the last
+
+    using link = std::conditional_t<(headers + nb_cols <= UINT16_MAX), uint16_t, uint32_t>;
+
+    struct node {
+        link up;
+        link down;
+        link col;
+    };
+
+    // Horizontal neighbours of a row node
+    static inline int next(const int j) { return (j & ~3) | ((j + 1) & 3); }
+    static inline int prev(const int j) { return (j & ~3) | ((j + 3) & 3); }
+
+    void cover(const int c);
+    void uncover(const int c);
+    void select(const int r);
+    void unselect(const int r);
+    int choose() const;
+
+    std::vector<node> _nodes;
+    std::vector<link> _left;   // Headers still to cover, root included
+    std::vector<link> _right;
+    std::vector<int> _size;    // Rows left in each column
+
+    std::array<int, dims::tiles> _chosen;  // Node of each selected row, clues first
+    int _depth = 0;                        // Nb of selected rows
+};
+
+/**
+ * @brief Links every row of the grid
+ */
+template <int Box>
+arena<Box>::arena()
+    : _nodes(headers + nb_cols), _left(nb_cols + 1), _right(nb_cols + 1), _size(nb_cols, 0)
+{
+    for (int c = 0; c <= nb_cols; ++c) {
+        _left[c] = (c + nb_cols) % (nb_cols + 1);
+        _right[c] = (c + 1) % (nb_cols + 1);
+    }
+
+    for (int c = 0; c < nb_cols; ++c) {
+        _nodes[headers + c] = {static_cast<link>(headers + c), static_cast<link>(headers + c), static_cast<link>(c)};
+    }
+
+    for (int r = 0; r < nb_rows; ++r) {
+        const int idx = r / n;
+        const int d = r % n;
+        const int i = idx / n;
+        const int j = idx % n;
+        const int b = (i / Box) * Box + j / Box;
+
+        const std::array<int, 4> cols = {idx,
+                                         dims::tiles + i * n + d,
+                                         2 * dims::tiles + j * n + d,
+                                         3 * dims::tiles + b * n + d};
+
+        for (int k = 0; k < 4; ++k) {
+            // Appended at the bottom of its column
+            const int x = 4 * r + k;
+            const int h = headers + cols[k];
+            const int last = _nodes[h].up;
+
+            _nodes[x] = {static_cast<link>(last), static_cast<link>(h), static_cast<link>(cols[k])};
+            _nodes[last].down = x;
+            _nodes[h].up = x;
+            _size[cols[k]]++;
+        }
+    }
+}
+
+/**
+ * @brief Removes a column from the headers and its rows from the other columns
+ *
+ * @param c Column
+ */
+template <int Box>
+inline void arena<Box>::cover(const int c)
+{
+    _right[_left[c]] = _right[c];
+    _left[_right[c]] = _left[c];
+
+    const int h = headers + c;
+    for (int i = _nodes[h].down; i != h; i = _nodes[i].down) {
+        for (int j = next(i); j != i; j = next(j)) {
+            node& x = _nodes[j];
+            _nodes[x.down].up = x.up;
+            _nodes[x.up].down = x.down;
+            _size[x.col]--;
+        }
+    }
+}
+
+/**
+ * @brief Reverts the last cover of a column
+ *
+ * @param c Column
+ */
+template <int Box>
+inline void arena<Box>::uncover(const int c)
+{
+    const int h = headers + c;
+    for (int i = _nodes[h].up; i != h; i = _nodes[i].up) {
+        for (int j = prev(i); j != i; j = prev(j)) {
+            const node& x = _nodes[j];
+            _size[x.col]++;
+            _nodes[x.down].up = j;
+            _nodes[x.up].down = j;
+        }
+    }
+
+    _right[_left[c]] = c;
+    _left[_right[c]] = c;
+}
+
+/**
+ * @brief Covers the columns of a row, its own column first
+ *
+ * @param r Node of the row
+ */
+template <int Box>
+inline void arena<Box>::select(const int r)
+{
+    cover(_nodes[r].col);
+    for (int j = next(r); j != r; j = next(j)) {
+        cover(_nodes[j].col);
+    }
+}
+
+template <int Box>
+inline void arena<Box>::unselect(const int r)
+{
+    for (int j = prev(r); j != r; j = prev(j)) {
+        uncover(_nodes[j].col);
+    }
+    uncover(_nodes[r].col);
+}
+
+/**
+ * @brief Column with the fewest rows left, the first one among ties
+ *
+ * @return Column
+ */
+template <int Box>
+inline int arena<Box>::choose() const
+{
+    int best = _right[root];
+    for (int c = _right[best]; c != root && _size[best] > 1; c = _right[c]) {
+        if (_size[c] < _size[best]) {
+            best = c;
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief Selects the rows of the clues
+ *
+ * @param board Puzzle, digits too large for the grid being blanks
+ * @return false if two clues share a constraint
+ */
+template <int Box>
+bool arena<Box>::place(const std::string& board)
+{
+    for (int idx = 0; idx < dims::tiles; ++idx) {
+        const int digit = utils::to_digit(board[idx]);
+
+        if (!digit || digit > n) {
+            continue;
+        }
+
+        const int r = 4 * (idx * n + digit - 1);
+
+        // A row sharing a column with a selected row was unlinked from its
+        // other columns
+        for (int k = 0; k < 4; ++k) {
+            if (_nodes[_nodes[r + k].up].down != r + k) {
+                return false;
+            }
+        }
+
+        select(r);
+        _chosen[_depth++] = r;
+    }
+    return true;
+}
+
+/**
+ * @brief Searches the exact covers completing the selected rows
+ *
+ * @param lim Limits of the search
+ * @param limit Nb of solutions after which the search stops
+ * @param board Filled with the first solution found
+ * @param result Status of the search
+ * @return Nb of solutions found
+ */
+template <int Box>
+int arena<Box>::search(limits& lim, const int limit, std::string& board, wfc::status& result)
+{
+    const int base = _depth;
+    int found = 0;
+    bool descend = true;
+
+    result = wfc::status::unsolvable;
+
+    for (;;) {
+        if (descend) {
+            if (_right[root] == root) {
+                // Every constraint covered
+                if (!found++) {
+                    for (int k = 0; k < _depth; ++k) {
+                        const int r = _chosen[k] / 4;
+                        board[r / n] = utils::to_char(r % n + 1);
+                    }
+                }
+                if (found == limit) {
+                    result = wfc::status::solved;
+                    break;
+                }
+                descend = false;
+                continue;
+            }
+
+            const int c = choose();
+            cover(c);
+            _chosen[_depth] = _nodes[headers + c].down;
+
+            if constexpr (stats::enabled) {
+                stats::depth(_depth - base + 1);
+            }
+
+        } else {
+            if (_depth == base) {
+                // Search space exhausted
+                break;
+            }
+
+            // Tries the next row of the column of the last level
+            const int r = _chosen[--_depth];
+            for (int j = prev(r); j != r; j = prev(j)) {
+                uncover(_nodes[j].col);
+            }
+            _chosen[_depth] = _nodes[r].down;
+        }
+
+        const int r = _chosen[_depth];
+
+        if (r >= headers) {
+            // No row left in the column
+            uncover(r - headers);
+            stats::backtrack();
+            descend = false;
+            continue;
+        }
+
+        // Rows of columns left with a single row are forced, not decisions
+        if (lim.interrupted() || (_size[_nodes[r].col] > 1 && lim.exceeded())) {
+            uncover(_nodes[r].col);
+            result = wfc::status::aborted;
+            break;
+        }
+
+        stats::node();
+
+        for (int j = next(r); j != r; j = next(j)) {
+            cover(_nodes[j].col);
+        }
+        ++_depth;
+        descend = true;
+    }
+
+    if (found && result == wfc::status::unsolvable) {
+        // Fewer solutions than the limit, all of them found
+        result = wfc::status::solved;
+    }
+    return found;
+}
+
+/**
+ * @brief Unselects every row, clues included, back to the initial links
+ */
+template <int Box>
+void arena<Box>::reset()
+{
+    while (_depth) {
+        unselect(_chosen[--_depth]);
+    }
+}
+
+/**
+ * @brief Runs the search on the arena of the calling thread
+ *
+ * @param board Puzzle, filled with the first solution found
+ * @param lim Limits of the search
+ * @param limit Nb of solutions after which the search stops
+ * @param result Status of the search
+ * @return Nb of solutions found
+ */
+template <int Box>
+int run(std::string& board, limits& lim, const int limit, wfc::status& result)
+{
+    thread_local arena<Box> links;
+
+    int found = 0;
+    result = wfc::status::unsolvable;
+
+    if (links.place(board)) {
+        found = links.search(lim, limit, board, result);
+    }
+    links.reset();
+
+    return found;
+}
+
+}  // namespace
+
+
+/**
+ * @brief An exact cover Sudoku Solver. Columns with the fewest rows are
+ * covered first, rows in order, so the search is deterministic. The engine,
+ * restarts, portfolio and checkpoints of the options are WFC settings,
+ * ignored here
+ *
+ * @param board Sudoku board encoded in string format, filled with the solution
+ * @param options Limits of the search
+ * @return Status of the search
+ */
+template <int Box>
+wfc::status dlx::solve(std::string& board, const wfc::solve_options& options)
+{
+    // Tasks run at a checkpoint would find the arena of the thread in use
+    wfc::solve_options local = options;
+    local.preempt_every = 0;
+
+    limits lim(local);
+    wfc::status result;
+    run<Box>(board, lim, 1, result);
+    return result;
+}
+
+/**
+ * @brief Counts the solutions of a board, up to a limit
+ *
+ * @param board Sudoku board encoded in string format, filled with the first
+ * solution found
+ * @param limit Nb of solutions after which the search stops
+ * @return Nb of solutions, at most the limit
+ */
+template <int Box>
+int dlx::count_solutions(std::string& board, const int limit)
+{
+    const wfc::solve_options options;
+    limits lim(options);
+    wfc::status result;
+    return run<Box>(board, lim, limit, result);
+}
+
+template wfc::status dlx::solve<2>(std::string&, const wfc::solve_options&);
+template wfc::status dlx::solve<3>(std::string&, const wfc::solve_options&);
+template wfc::status dlx::solve<4>(std::string&, const wfc::solve_options&);
+template wfc::status dlx::solve<5>(std::string&, const wfc::solve_options&);
+
+template int dlx::count_solutions<2>(std::string&, const int);
+template int dlx::count_solutions<3>(std::string&, const int);
+template int dlx::count_solutions<4>(std::string&, const int);
+template int dlx::count_solutions<5>(std::string&, const int);
+
+}  // namespace sudoku
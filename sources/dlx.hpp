@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+
+#include "sudoku.hpp"
+
+
+namespace sudoku
+{
+
+/**
+ * @brief Knuth's Algorithm X on dancing links. A puzzle is the exact cover of
+ * its tile, row, col and box constraints by rows (tile, digit), clues being
+ * rows chosen in advance. Each thread links the rows of every size of grid
+ * once, and puzzles only cover and uncover them
+ */
+namespace dlx
+{
+
+template <int Box>
+wfc::status solve(std::string& board, const wfc::solve_options& options = {});
+
+template <int Box>
+int count_solutions(std::string& board, const int limit = 2);
+
+}  // namespace dlx
+
+}  // namespace sudoku
@@ -0,0 +1,220 @@
+#include "io.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define IO_MMAP
+#endif
+
+
+namespace io
+{
+
+/**
+ * @brief Maps a file in memory, or reads it whole if it cannot be mapped
+ *
+ * @param path Path to file
+ */
+mapped_file::mapped_file(const std::filesystem::path& path)
+{
+#ifdef IO_MMAP
+    if (const int fd = ::open(path.c_str(), O_RDONLY); fd >= 0) {
+        struct stat st;
+
+        if (::fstat(fd, &st) == 0) {
+            _size = st.st_size;
+            _open = true;
+
+            if (_size > 0) {
+                void* addr = ::mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+                if (addr != MAP_FAILED) {
+                    ::madvise(addr, _size, MADV_SEQUENTIAL);
+                    _data = static_cast<const char*>(addr);
+                    _mapped = true;
+                }
+            }
+        }
+        ::close(fd);
+
+        if (_mapped || (_open && _size == 0)) {
+            return;
+        }
+    }
+#endif
+
+    std::ifstream file(path, std::ios::binary);
+
+    if (file.is_open()) {
+        _buffer.assign(std::istreambuf_iterator<char>(file), {});
+        _data = _buffer.data();
+        _size = _buffer.size();
+        _open = true;
+    }
+}
+
+mapped_file::~mapped_file()
+{
+#ifdef IO_MMAP
+    if (_mapped) {
+        ::munmap(const_cast<char*>(_data), _size);
+    }
+#endif
+}
+
+/**
+ * @brief Gives the pages before offset back to the system, which keeps the
+ * memory of a sequential read bounded
+ *
+ * @param offset Bytes already consumed
+ */
+void mapped_file::release(const std::size_t offset)
+{
+#ifdef IO_MMAP
+    if (!_mapped) {
+        return;
+    }
+
+    const std::size_t page = ::sysconf(_SC_PAGESIZE);
+    const std::size_t end = (offset / page) * page;
+
+    if (end > _released) {
+        ::madvise(const_cast<char*>(_data) + _released, end - _released, MADV_DONTNEED);
+        _released = end;
+    }
+#endif
+}
+
+/**
+ * @brief Reads the next lines, skipping empty ones and carriage returns
+ *
+ * @param lines Array of views over the buffer, cleared then filled
+ * @param max_lines Maximal nb of lines to read
+ * @return Nb of lines read, 0 at the end of the buffer
+ */
+std::size_t line_reader::next(std::vector<std::string_view>& lines, const std::size_t max_lines)
+{
+    lines.clear();
+
+    while (_pos < _data.size() && lines.size() < max_lines) {
+        std::size_t end = _data.find('\n', _pos);
+        if (end == std::string_view::npos) {
+            end = _data.size();
+        }
+
+        std::string_view line = _data.substr(_pos, end - _pos);
+        _pos = end + 1;
+
+        if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+        if (!line.empty()) {
+            lines.push_back(line);
+        }
+    }
+
+    _pos = std::min(_pos, _data.size());
+    return lines.size();
+}
+
+/**
+ * @brief Opens the output and starts the writing thread
+ *
+ * @param path Path to output file
+ * @param buffer_size Bytes gathered before each write
+ */
+ordered_writer::ordered_writer(const std::filesystem::path& path, const std::size_t buffer_size)
+    : _file(path, std::ios::binary), _buffer_size(buffer_size)
+{
+    _buffer.reserve(buffer_size);
+    _thread = std::thread(&ordered_writer::work, this);
+}
+
+/**
+ * @brief Writes the records left and joins the writing thread
+ */
+ordered_writer::~ordered_writer()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _stop = true;
+    }
+    _cv.notify_one();
+    _thread.join();
+}
+
+/**
+ * @brief Hands a record over to the writing thread, which writes it once all
+ * the records before it are written
+ *
+ * @param index Position of the record in the output, each index pushed once
+ * @param record Formatted record
+ */
+void ordered_writer::push(const std::size_t index, std::string record)
+{
+    bool ready;
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+
+        const std::size_t slot = index - _next;
+        if (slot >= _pending.size()) {
+            _pending.resize(slot + 1);
+        }
+        _pending[slot] = std::move(record);
+        ready = (slot == 0);
+    }
+
+    if (ready) {
+        _cv.notify_one();
+    }
+}
+
+/**
+ * @brief Takes the records that are next in order and appends them to the
+ * buffer, written whenever it is full and once at the end
+ */
+void ordered_writer::work()
+{
+    std::vector<std::string> records;
+    std::unique_lock<std::mutex> lock(_mtx);
+
+    while (true) {
+        _cv.wait(lock, [this] { return _stop || (!_pending.empty() && _pending.front()); });
+
+        while (!_pending.empty() && _pending.front()) {
+            records.push_back(std::move(*_pending.front()));
+            _pending.pop_front();
+            _next++;
+        }
+
+        if (records.empty() && _stop) {
+            break;
+        }
+
+        // Writing does not hold back the workers pushing records
+        lock.unlock();
+
+        for (const std::string& record : records) {
+            _buffer += record;
+
+            if (_buffer.size() >= _buffer_size) {
+                _file.write(_buffer.data(), _buffer.size());
+                _buffer.clear();
+            }
+        }
+        records.clear();
+
+        lock.lock();
+    }
+
+    _file.write(_buffer.data(), _buffer.size());
+    _file.flush();
+}
+
+}  // namespace io
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+
+namespace io
+{
+
+/**
+ * @brief Read-only view over a whole file, memory mapped when the platform
+ * allows it, so that its lines can be handed out without copies
+ */
+class mapped_file final
+{
+public:
+    explicit mapped_file(const std::filesystem::path& path);
+    ~mapped_file();
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    inline bool is_open() const { return _open; }
+    inline std::string_view data() const { return {_data, _size}; }
+
+    void release(const std::size_t offset);
+
+private:
+    const char* _data = nullptr;
+    std::size_t _size = 0;
+    std::size_t _released = 0;  // Bytes already given back to the system
+    bool _open = false;
+    bool _mapped = false;
+
+    std::string _buffer;  // File content when it cannot be mapped
+};
+
+/**
+ * @brief Splits a buffer into its non-empty lines, one batch at a time
+ */
+class line_reader final
+{
+public:
+    explicit line_reader(std::string_view data) : _data(data) {}
+
+    inline std::size_t offset() const { return _pos; }
+    std::size_t next(std::vector<std::string_view>& lines, const std::size_t max_lines);
+
+private:
+    std::string_view _data;
+    std::size_t _pos = 0;
+};
+
+/**
+ * @brief Writes records pushed by the workers in any order, in the order of
+ * their index, from a dedicated thread through a large buffer
+ */
+class ordered_writer final
+{
+public:
+    explicit ordered_writer(const std::filesystem::path& path, const std::size_t buffer_size = 1 << 20);
+    ~ordered_writer();
+
+    ordered_writer(const ordered_writer&) = delete;
+    ordered_writer& operator=(const ordered_writer&) = delete;
+
+    inline bool is_open() const { return _file.is_open(); }
+
+    void push(const std::size_t index, std::string record);
+
+private:
+    void work();
+
+    std::ofstream _file;
+    std::string _buffer;        // Records not written yet, flushed once full
+    std::size_t _buffer_size;
+
+    std::mutex _mtx;
+    std::condition_variable _cv;
+    std::deque<std::optional<std::string>> _pending;  // Reorder buffer, from record _next on
+    std::size_t _next = 0;                            // Index of the next record to write
+    bool _stop = false;
+
+    std::thread _thread;
+};
+
+}  // namespace io
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <random>
+
+#include "stats.hpp"
+#include "sudoku.hpp"
+#include "utils.hpp"
+
+
+namespace sudoku
+{
+
+/**
+ * @brief Limits of one search. The node budget is counted at each decision
+ * and the cancellation flags are read at each iteration, while the stop token
+ * and the clock are only checked every few iterations
+ */
+class limits
+{
+public:
+    limits(const wfc::solve_options& options, const std::atomic_bool* found = nullptr)
+        : _options(options), _found(found)
+    {
+    }
+
+    /**
+     * @brief Counts a decision, yielding to the interactive tasks of the pool
+     * at each checkpoint
+     *
+     * @return true once over the node budget
+     */
+    inline bool exceeded()
+    {
+        ++_nodes;
+        if (_options.preempt_every && _nodes % _options.preempt_every == 0 && utils::thread_pool::preemptible()) {
+            preempt();
+        }
+        return _options.max_nodes && _nodes > _options.max_nodes;
+    }
+
+    /**
+     * @brief Tells whether the search stopped on its node budget
+     *
+     * @return true if over the budget
+     */
+    inline bool over_budget() const
+    {
+        return _options.max_nodes && _nodes > _options.max_nodes;
+    }
+
+    inline uint64_t nodes() const { return _nodes; }
+
+    /**
+     * @brief Checks the cancellations and the deadline
+     *
+     * @return true once the search must stop
+     */
+    inline bool interrupted()
+    {
+        if ((_found && _found->load(std::memory_order_relaxed)) ||
+            (_options.cancel && _options.cancel->load(std::memory_order_relaxed))) {
+            return true;
+        }
+
+        if (_ticks++ % check_period) {
+            return false;
+        }
+        return _options.stop.stop_requested() ||
+               (_options.deadline && std::chrono::steady_clock::now() >= *_options.deadline);
+    }
+
+private:
+    static constexpr uint32_t check_period = 64;
+
+    /**
+     * @brief Runs the interactive tasks waiting on this worker. They reseed
+     * the random engine of the thread and take its counters, both restored
+     * before the search goes on
+     */
+    void preempt()
+    {
+        const std::mt19937 rng = utils::rng();
+        const stats::counters counters = stats::take();
+
+        utils::thread_pool::yield();
+
+        utils::rng() = rng;
+        stats::take();
+        stats::add(counters);
+    }
+
+    const wfc::solve_options& _options;
+    const std::atomic_bool* _found;  // Raised when another subtree found the solution
+    uint64_t _nodes = 0;
+    uint32_t _ticks = 0;
+};
+
+}  // namespace sudoku
@@ -1,24 +1,188 @@
+#include <algorithm>
 #include <atomic>
+#include <charconv>
 #include <chrono>
-#include <ctype.h>
+#include <condition_variable>
+#include <csignal>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <span>
 #include <string>
 #include <vector>
 
+#include "cache.hpp"
+#include "canon.hpp"
+#include "codec.hpp"
+#include "dlx.hpp"
+#include "io.hpp"
 #include "optim.hpp"
+#include "server.hpp"
+#include "stats.hpp"
 #include "sudoku.hpp"
 #include "utils.hpp"
 
 
+#ifdef ORTOOLS
+inline constexpr bool has_ortools = true;
+#else
+inline constexpr bool has_ortools = false;
+#endif
+
+enum class solver {
+    wfc,        // Wave function collapse search
+    dlx,        // Dancing links exact cover
+    cp,         // OR-Tools CP-SAT
+    lp,         // OR-Tools MIP
+    automatic,  // WFC under a node budget, then CP-SAT
+};
+
+enum class schedule {
+    fifo,  // Puzzles taken in input order
+    lpt,   // Puzzles estimated the hardest taken first
+};
+
+enum class layout {
+    pretty,   // Puzzle and solution side by side, one row per line
+    compact,  // Puzzle and solution on one line
+};
+
 struct arguments {
     std::filesystem::path path{
         "data/benchmark10k.txt"};  // Path to file with sudoku puzzles
     int nb_threads{4};             // Chosen number of threads
     bool output_solutions{false};  // Write solutions to file flag
+    layout format{layout::pretty}; // Layout of the solutions file
+#ifdef DEBUG
+    std::optional<uint64_t> seed{2};  // Base seed of reproducible runs
+#else
+    std::optional<uint64_t> seed;     // Base seed of reproducible runs
+#endif
+    sudoku::wfc::engine engine{sudoku::wfc::engine::copy};  // Search engine
+    bool bitboard{false};          // Solve on digit planes flag
+    bool verify{false};            // Check solutions flag
+    int batch_size{4096};          // Puzzles read and solved at a time
+    schedule order{schedule::fifo};  // Order in which the puzzles of a batch are dispatched
+    std::optional<std::filesystem::path> convert;  // Output of text/binary conversion
+    std::optional<std::filesystem::path> stats_csv;  // Output of per-puzzle statistics
+    int count{0};                  // Counts solutions up to this limit instead of solving, if set
+    sudoku::inference inference{sudoku::inference::singles};  // Rules run after each collapse
+    std::size_t cache_mb{0};       // Memory budget of the solution cache, none if 0
+    solver backend{solver::wfc};   // Solver of the grids, 9x9 only for OR-Tools, the WFC solving the others
+    uint64_t node_budget{1000};    // Decisions before the WFC hands a puzzle off in auto mode
+    uint64_t max_nodes{0};         // Decisions before the WFC gives up on a puzzle, no limit if 0
+    uint64_t timeout_ms{0};        // Time before the WFC gives up on a puzzle, no limit if 0
+    uint64_t restart_base{0};      // Decisions of the first WFC run between Luby restarts, no restarts if 0
+    int portfolio{0};              // Seeded copies of each puzzle raced on idle workers, if above 1
+    uint64_t preempt_every{0};     // WFC decisions between the checkpoints running interactive requests, never if 0
+    int optim_threads{1};          // Search workers of each OR-Tools solve
+    std::string cp_params;         // CP-SAT parameters, in protobuf text format
+    std::string lp_params;         // MIP solver specific parameters
+    std::optional<std::filesystem::path> serve;  // Unix socket answering requests, stdin and stdout if empty
+};
+
+/**
+ * @brief Nb of puzzles solved by one backend and the time it took, gathered
+ * from all the workers
+ */
+struct backend_time {
+    std::atomic_uint64_t puzzles = 0;
+    std::atomic_uint64_t ns = 0;
+    std::atomic_uint64_t max_ns = 0;
+
+    void add(const uint64_t elapsed)
+    {
+        puzzles++;
+        ns += elapsed;
+
+        uint64_t max = max_ns.load(std::memory_order_relaxed);
+        while (elapsed > max && !max_ns.compare_exchange_weak(max, elapsed)) {
+        }
+    }
+
+    void print(std::ostream& out, std::string_view name) const
+    {
+        if (!puzzles) {
+            return;
+        }
+        out << name << ": " << puzzles << " puzzles in " << ns * 1.e-9 << "s (mean "
+            << ns * 1.e-3 / puzzles << "us, max " << max_ns * 1.e-3 << "us)\n";
+    }
+};
+
+struct backend_times {
+    backend_time wfc;          // Puzzles the WFC solved
+    backend_time over_budget;  // Puzzles the WFC gave up on, handed off
+    backend_time dlx;
+    backend_time cp;
+    backend_time lp;
+};
+
+/**
+ * @brief Nb of puzzles per outcome, gathered from all the workers
+ */
+struct outcomes {
+    std::atomic_int solved = 0;
+    std::atomic_int unsolvable = 0;
+    std::atomic_int aborted = 0;    // Over a limit or interrupted
+    std::atomic_int malformed = 0;  // Lines that are not a grid
+
+    void add(const sudoku::wfc::status result)
+    {
+        switch (result) {
+        case sudoku::wfc::status::solved:
+            solved++;
+            break;
+        case sudoku::wfc::status::unsolvable:
+            unsolvable++;
+            break;
+        case sudoku::wfc::status::aborted:
+            aborted++;
+            break;
+        }
+    }
 };
 
+// Raised on SIGINT: searches in flight are aborted and no more puzzles are read
+std::atomic_bool interrupted = false;
+static_assert(std::atomic_bool::is_always_lock_free, "Flag must be usable from a signal handler");
+
+extern "C" void on_interrupt(int)
+{
+    interrupted = true;
+}
+
+
+// Keeps the deadlines of the searches within the range of the clock
+constexpr uint64_t max_timeout_ms = uint64_t{1} << 40;
+
+// Keeps the tally of puzzles per nb of solutions small enough to allocate
+constexpr int max_count = 1 << 20;
+
+/**
+ * @brief Reads a whole string as a number
+ *
+ * @param sv String
+ * @param min Smallest value accepted
+ * @param max Largest value accepted
+ * @return The number, none if the string is not one or it is out of range
+ */
+template <typename T>
+std::optional<T> to_number(std::string_view sv, const T min = 0, const T max = std::numeric_limits<T>::max())
+{
+    T value;
+    const auto [end, error] = std::from_chars(sv.data(), sv.data() + sv.size(), value);
+
+    if (sv.empty() || error != std::errc() || end != sv.data() + sv.size() || value < min || value > max) {
+        return std::nullopt;
+    }
+    return value;
+}
 
 /**
  * @brief Parse command line
@@ -26,191 +190,1084 @@ struct arguments {
  * @param argc Nb of arguments
  * @param argv Array of arguments
  * @param args Reference to arguments object
- * @return Array of grids
- */
-std::vector<std::string> parse(const int argc,
-                               const char** argv,
-                               arguments& args)
-{
-    // Checks if string is a number
-    auto is_numeric = [](std::string_view sv) {
-        return (!sv.empty() &&
-                std::find_if(sv.begin(), sv.end(), [](unsigned char c) {
-                    return !std::isdigit(c);
-                }) == sv.end());
-    };
+ */
+void parse(const int argc, const char** argv, arguments& args)
+{
+    // Splits '--key=value' options from positional arguments
+    std::vector<std::string_view> positionals;
 
-    switch (argc) {
-    case 4:
-        if (std::string(argv[3]) == "1") {
-            args.output_solutions = true;
+    for (int a = 1; a < argc; ++a) {
+        const std::string_view arg = argv[a];
+
+        if (!arg.starts_with("--")) {
+            positionals.push_back(arg);
+            continue;
         }
-        [[fallthrough]];
 
+        const std::size_t eq = arg.find('=');
+        const std::string_view key = arg.substr(2, eq - 2);
+        const std::string_view value =
+            (eq == std::string_view::npos) ? "" : arg.substr(eq + 1);
+
+        // Values of the numeric options, none if out of range
+        const std::optional<uint64_t> number = to_number<uint64_t>(value);
+        const std::optional<int> positive = to_number<int>(value, 1);
+
+        if (key == "seed" && number) {
+            args.seed = *number;
+
+        } else if (key == "engine" && value == "copy") {
+            args.engine = sudoku::wfc::engine::copy;
+
+        } else if (key == "engine" && value == "trail") {
+            args.engine = sudoku::wfc::engine::trail;
+
+        } else if (key == "inference" && value == "singles") {
+            args.inference = sudoku::inference::singles;
+
+        } else if (key == "inference" && value == "locked") {
+            args.inference = sudoku::inference::locked;
+
+        } else if (key == "inference" && value == "subsets") {
+            args.inference = sudoku::inference::subsets;
+
+        } else if (key == "format" && (value == "pretty" || value == "compact")) {
+            args.format = (value == "compact") ? layout::compact : layout::pretty;
+
+        } else if (key == "board" && (value == "tile" || value == "simd")) {
+            args.bitboard = (value == "simd");
+
+        } else if (key == "schedule" && (value == "fifo" || value == "lpt")) {
+            args.order = (value == "lpt") ? schedule::lpt : schedule::fifo;
+
+        } else if (key == "verify" && value.empty()) {
+            args.verify = true;
+
+        } else if (key == "batch" && positive) {
+            args.batch_size = *positive;
+
+        } else if (key == "convert" && !value.empty()) {
+            args.convert = value;
+
+        } else if (const auto limit = to_number<int>(value, 1, max_count); key == "count" && limit) {
+            args.count = *limit;
+
+        } else if (key == "solver" &&
+                   (value == "wfc" || value == "dlx" || value == "cp" || value == "lp" || value == "auto")) {
+            args.backend = value == "dlx"  ? solver::dlx
+                         : value == "cp"   ? solver::cp
+                         : value == "lp"   ? solver::lp
+                         : value == "auto" ? solver::automatic
+                                           : solver::wfc;
+
+            if (!has_ortools && args.backend != solver::wfc && args.backend != solver::dlx) {
+                std::cerr << "OR-Tools is not built in, solving with the WFC only." << std::endl;
+                args.backend = solver::wfc;
+            }
+
+        } else if (key == "node-budget" && number && *number > 0) {
+            args.node_budget = *number;
+
+        } else if (key == "max-nodes" && number) {
+            args.max_nodes = *number;
+
+        } else if (const auto ms = to_number<uint64_t>(value, 0, max_timeout_ms); key == "timeout" && ms) {
+            args.timeout_ms = *ms;
+
+        } else if (key == "restarts" && number) {
+            args.restart_base = *number;
+
+        } else if (const auto copies = to_number<int>(value); key == "portfolio" && copies) {
+            args.portfolio = *copies;
+
+        } else if (key == "preempt" && number) {
+            args.preempt_every = *number;
+
+        } else if (key == "optim-threads" && positive) {
+            args.optim_threads = *positive;
+
+        } else if (key == "cp-params" && !value.empty()) {
+            args.cp_params = value;
+
+        } else if (key == "lp-params" && !value.empty()) {
+            args.lp_params = value;
+
+        } else if (key == "serve") {
+            args.serve = value;
+
+        } else if (const auto mb = to_number<std::size_t>(value, 0, SIZE_MAX >> 20); key == "cache" && mb) {
+            args.cache_mb = *mb;
+
+        } else if (key == "stats-csv" && !value.empty()) {
+            if (!stats::enabled) {
+                std::cerr << "Statistics are not built in, configure with -DWFC_STATS=ON." << std::endl;
+                exit(1);
+            }
+            args.stats_csv = value;
+
+        } else {
+            std::cerr << "Unknown or invalid option '" << arg << "'." << std::endl;
+            exit(1);
+        }
+    }
+
+    switch (positionals.size()) {
     case 3:
-        if (is_numeric(argv[2])) {
-            args.nb_threads = std::stoi(argv[2]);
+        if (positionals[2] == "1") {
+            args.output_solutions = true;
         }
         [[fallthrough]];
 
     case 2:
-        args.path = argv[1];
+        if (const auto threads = to_number<int>(positionals[1])) {
+            args.nb_threads = *threads;
+        }
+        [[fallthrough]];
+
+    case 1:
+        args.path = positionals[0];
         [[fallthrough]];
 
     default:
         break;
     }
 
-    std::vector<std::string> grids;
-    std::ifstream file(args.path);
+    // Guards against too many/few cores to use
+    args.nb_threads = std::clamp(
+        args.nb_threads,
+        1,
+        std::max(1, (int)std::thread::hardware_concurrency()));
+}
+
+/**
+ * @brief Reads a grid on a board
+ *
+ * @param grid Grid
+ * @param level Inference rules of the tile boards
+ * @return Board
+ */
+template <typename Board>
+Board make_board(std::string_view grid, const sudoku::inference level)
+{
+    if constexpr (std::is_same_v<Board, sudoku::bitboard>) {
+        // Digit planes only infer singles
+        return Board(grid);
+    } else {
+        return Board(grid, level);
+    }
+}
+
+/**
+ * @brief Solve one sudoku board
+ *
+ * @param grid Grid to solve
+ * @param options Engine and limits of the search
+ * @param args Parsed arguments
+ * @param pool Thread pool to split the search on, nullptr to search alone
+ * @param solution Filled with the solution, empty if none was found
+ * @return Status of the search
+ */
+template <typename Board>
+sudoku::wfc::status solve(std::string_view grid,
+                          const sudoku::wfc::solve_options& options,
+                          const arguments& args,
+                          utils::thread_pool* pool,
+                          std::string& solution)
+{
+    Board board = make_board<Board>(grid, args.inference);
+
+    const sudoku::wfc::status result = pool ? sudoku::wfc::solve(board, *pool, options)
+                                            : sudoku::wfc::solve(board, options);
+
+    solution = (result == sudoku::wfc::status::solved) ? board.serialize() : "";
+    return result;
+}
+
+/**
+ * @brief Solve one 9x9 sudoku board with an OR-Tools backend
+ *
+ * @param grid Grid to solve
+ * @param backend Constraint programming or mixed integer programming
+ * @param solution Filled with the solution, empty if none was found
+ * @return Status of the search
+ */
+sudoku::wfc::status solve_optim([[maybe_unused]] std::string_view grid,
+                                [[maybe_unused]] const solver backend,
+                                std::string& solution)
+{
+    solution.clear();
+
+#ifdef ORTOOLS
+    std::string board(grid);
+    const bool solved = (backend == solver::lp) ? sudoku::lp::solve(board)
+                                                : sudoku::cp::solve(board);
+    if (solved) {
+        solution = std::move(board);
+        return sudoku::wfc::status::solved;
+    }
+#endif
+    return sudoku::wfc::status::unsolvable;
+}
+
+/**
+ * @brief Solve one sudoku board with dancing links
+ *
+ * @param grid Grid to solve
+ * @param options Limits of the search
+ * @param solution Filled with the solution, empty if none was found
+ * @return Status of the search
+ */
+template <int Box>
+sudoku::wfc::status solve_dlx(std::string_view grid, const sudoku::wfc::solve_options& options, std::string& solution)
+{
+    solution = grid.substr(0, utils::dims<Box>::tiles);
+
+    const sudoku::wfc::status result = sudoku::dlx::solve<Box>(solution, options);
+
+    if (result != sudoku::wfc::status::solved) {
+        solution.clear();
+    }
+    return result;
+}
+
+/**
+ * @brief Stores the solution of a puzzle under its canonical form
+ *
+ * @param grid Solved puzzle
+ * @param solution Its solution
+ * @param solutions Cache of canonical solutions keyed by canonical puzzles
+ */
+template <int Box>
+void remember(std::string_view grid, std::string_view solution, cache::lru& solutions)
+{
+    const canon::form<Box> form = canon::canonicalize<Box>(grid);
+    solutions.insert(form.grid, form.map.apply(solution));
+}
+
+/**
+ * @brief Solve one sudoku board, unless a puzzle with the same canonical form
+ * was solved before
+ *
+ * @param grid Grid to solve
+ * @param solutions Cache of canonical solutions keyed by canonical puzzles
+ * @param search Callable solving the grid on a miss
+ * @param solution Filled with the solution, empty if none was found
+ * @return Status of the search, solved on a hit
+ */
+template <int Box, typename Search>
+sudoku::wfc::status solve_cached(std::string_view grid,
+                                 cache::lru& solutions,
+                                 Search search,
+                                 std::string& solution)
+{
+    const canon::form<Box> form = canon::canonicalize<Box>(grid);
+
+    if (const auto hit = solutions.find(form.grid)) {
+        solution = form.map.revert(*hit);
+        return sudoku::wfc::status::solved;
+    }
+
+    const sudoku::wfc::status result = search(grid, solution);
+
+    if (result == sudoku::wfc::status::solved) {
+        solutions.insert(form.grid, form.map.apply(solution));
+    }
+    return result;
+}
 
-    if (file.is_open()) {
-        std::string grid;
+/**
+ * @brief Counts the solutions of one sudoku board, up to a limit
+ *
+ * @param grid Grid to solve
+ * @param args Parsed arguments
+ * @param solution Filled with the first solution found, empty if none
+ * @return Nb of solutions, at most the limit
+ */
+template <typename Board>
+int count(std::string_view grid, const arguments& args, std::string& solution)
+{
+    if (args.backend == solver::dlx) {
+        solution = grid.substr(0, Board::dims::tiles);
 
-        while (std::getline(file, grid)) {
-            grids.push_back(grid);
+        const int nb_solutions = sudoku::dlx::count_solutions<Board::dims::box>(solution, args.count);
+        if (!nb_solutions) {
+            solution.clear();
         }
+        return nb_solutions;
+    }
 
-    } else {
-        std::cerr << "File '" << args.path << "' not found." << std::endl;
-        exit(1);
+    Board board = make_board<Board>(grid, args.inference);
+
+    const int nb_solutions = sudoku::wfc::count_solutions(board, args.count);
+    solution = nb_solutions ? board.serialize() : "";
+    return nb_solutions;
+}
+
+/**
+ * @brief Calls f with the board type matching the grid size
+ *
+ * @param box Box size of the grid
+ * @param bitboard Digit planes flag, only for 9x9 grids
+ * @param f Callable taking a std::type_identity of the board type
+ * @return Result of f, default value if the size is not supported
+ */
+template <typename F>
+auto with_board(const int box, const bool bitboard, F f)
+{
+    switch (box) {
+    case 2:
+        return f(std::type_identity<sudoku::q_board<2>>{});
+
+    case 3:
+        // Digit planes only exist for 9x9 grids
+        return bitboard ? f(std::type_identity<sudoku::bitboard>{})
+                        : f(std::type_identity<sudoku::q_board<3>>{});
+    case 4:
+        return f(std::type_identity<sudoku::q_board<4>>{});
+
+    case 5:
+        return f(std::type_identity<sudoku::q_board<5>>{});
+
+    default:
+        return decltype(f(std::type_identity<sudoku::q_board<3>>{}))();
     }
+}
 
-    // Guards against too many/few cores to use or too many boards to print
-    args.nb_threads = std::clamp(
-        args.nb_threads,
-        1,
-        std::min((int)std::thread::hardware_concurrency(), (int)grids.size()));
+/**
+ * @brief Estimates how hard a grid is to search
+ *
+ * @param grid Puzzle
+ * @return Sort key, larger for harder puzzles, 0 for malformed lines
+ */
+uint64_t estimate(std::string_view grid)
+{
+    switch (utils::box_of(grid)) {
+    case 2:
+        return sudoku::estimate<2>(grid).key();
+    case 3:
+        return sudoku::estimate<3>(grid).key();
+    case 4:
+        return sudoku::estimate<4>(grid).key();
+    case 5:
+        return sudoku::estimate<5>(grid).key();
+    default:
+        return 0;
+    }
+}
 
-    return grids;
+/**
+ * @brief Checks a solution against the rules of the grid size
+ *
+ * @param grid Original puzzle
+ * @param solution Proposed solution
+ * @return true if valid,
+ * @return false otherwise
+ */
+bool is_solution(std::string_view grid, std::string_view solution)
+{
+    switch (utils::box_of(grid)) {
+    case 2:
+        return sudoku::is_solution<2>(grid, solution);
+    case 3:
+        return sudoku::is_solution<3>(grid, solution);
+    case 4:
+        return sudoku::is_solution<4>(grid, solution);
+    case 5:
+        return sudoku::is_solution<5>(grid, solution);
+    default:
+        return false;
+    }
 }
 
 /**
- * @brief Solve sudoku boards concurrently on a thread pool
+ * @brief Backend solving a grid: the OR-Tools models only handle 9x9 grids,
+ * the other sizes going to the WFC
  *
- * @param grids Array of grids to solve
- * @param nb_threads Nb of threads to use
- * @return Array of solved boards
+ * @param box Box size of the grid
+ * @param args Parsed arguments
+ * @return Backend
  */
-std::vector<std::string> run(const std::vector<std::string>& grids,
-                             const int nb_threads)
+solver backend_of(const int box, const arguments& args)
 {
-    sudoku::wfc::init();
+    return (box == BOX || args.backend == solver::dlx) ? args.backend : solver::wfc;
+}
 
-    std::atomic_uint unsolved = 0;
-    std::vector<std::string> solutions(grids.size(), "");
+/**
+ * @brief Limits of the search of one grid
+ *
+ * @param backend Backend solving the grid
+ * @param start Time the grid was taken, from which the timeout runs
+ * @param args Parsed arguments
+ * @return Options of the search
+ */
+sudoku::wfc::solve_options make_options(const solver backend,
+                                        const std::chrono::steady_clock::time_point start,
+                                        const arguments& args)
+{
+    using std::chrono::milliseconds;
 
-    {
-        // start concurrency
-        utils::thread_pool pool(nb_threads);
+    sudoku::wfc::solve_options options{.e = args.engine,
+                                       .max_nodes = args.max_nodes,
+                                       .deadline = args.timeout_ms ? std::optional(start + milliseconds(args.timeout_ms))
+                                                                   : std::nullopt,
+                                       .stop = {},
+                                       .cancel = &interrupted,
+                                       .restart_base = args.restart_base,
+                                       .portfolio = args.portfolio,
+                                       .preempt_every = args.preempt_every};
+    if (backend == solver::automatic) {
+        options.max_nodes = args.max_nodes ? std::min(args.max_nodes, args.node_budget) : args.node_budget;
+    }
+    return options;
+}
+
+/**
+ * @brief Runs a solve, adding its time to the backend picked from its status
+ *
+ * @param times Time spent by each backend, nullptr not to time the solve
+ * @param f Callable solving, returning its status
+ * @param pick Callable returning the backend_time of a status
+ * @return Status of f
+ */
+template <typename F, typename Pick>
+sudoku::wfc::status timed(backend_times* times, F f, Pick pick)
+{
+    if (!times) {
+        return f();
+    }
+    const auto start = std::chrono::steady_clock::now();
+    const sudoku::wfc::status result = f();
+    const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    pick(result).add(ns);
+    return result;
+}
+
+/**
+ * @brief Solve one grid with its backend, through the solution cache if any
+ *
+ * @param grid Grid to solve
+ * @param box Box size of the grid
+ * @param options Limits of the search
+ * @param pool Pool splitting or racing the WFC search, nullptr to search on the calling thread
+ * @param cache Solution cache, nullptr to always search
+ * @param times Time spent by each backend, nullptr not to time the solve
+ * @param args Parsed arguments
+ * @param solution Filled with the solution, empty if none was found
+ * @return Status of the search
+ */
+sudoku::wfc::status solve_grid(std::string_view grid,
+                               const int box,
+                               const sudoku::wfc::solve_options& options,
+                               utils::thread_pool* pool,
+                               cache::lru* cache,
+                               backend_times* times,
+                               const arguments& args,
+                               std::string& solution)
+{
+    using sudoku::wfc::status;
 
-        for (int i = 0; i < grids.size(); ++i) {
-            const auto& grid = grids[i];
+    const solver backend = backend_of(box, args);
 
-            pool.enqueue([i, &grid, &unsolved, &solutions] {
-                /*
-                  If one were to use the optimization methods
-                  instead of the WFC, this is how one could do it:
-                  std::string board = grid;
-                  if (sudoku::cp::solve(board)) solutions[i] = board;
-                  if (sudoku::lp::solve(board)) solutions[i] = board;
-                */
+    return with_board(box, args.bitboard, [&](auto board) {
+        using Board = typename decltype(board)::type;
 
-                sudoku::q_board board(grid);
+        auto search = [&](std::string_view grid, std::string& solution) {
+            if (backend == solver::dlx) {
+                return timed(times, [&] { return solve_dlx<Board::dims::box>(grid, options, solution); },
+                             [&](status) -> backend_time& { return times->dlx; });
+            }
+            if (backend == solver::cp || backend == solver::lp) {
+                return timed(times, [&] { return solve_optim(grid, backend, solution); },
+                             [&](status) -> backend_time& {
+                                 return backend == solver::cp ? times->cp : times->lp;
+                             });
+            }
+            return timed(times, [&] { return solve<Board>(grid, options, args, pool, solution); },
+                         [&](const status r) -> backend_time& {
+                             return (r == status::aborted && backend == solver::automatic) ? times->over_budget
+                                                                                          : times->wfc;
+                         });
+        };
 
-                if (sudoku::wfc::solve(board)) {
-                    solutions[i] = board.serialize();
+        return cache ? solve_cached<Board::dims::box>(grid, *cache, search, solution)
+                     : search(grid, solution);
+    });
+}
 
-                } else {
-                    unsolved++;
-                }
-            });
+/**
+ * @brief Formats the solution of a grid for the solutions file
+ *
+ * @param grid Original grid
+ * @param solution Solution found, empty if none
+ * @param index Index of the grid in the input
+ * @param format Layout
+ * @return Formatted record, ending with a new line
+ */
+std::string format(std::string_view grid,
+                   std::string_view solution,
+                   const std::size_t index,
+                   const layout format)
+{
+    std::string out;
+
+    if (format == layout::compact) {
+        // e.g. "<grid> <solution>", or "<grid> -" when not solved
+        out.reserve(2 * grid.size() + 2);
+        out.append(grid).append(" ").append(solution.empty() ? "-" : solution).append("\n");
+        return out;
+    }
+
+    if (solution.empty()) {
+        out.append("No solution found for Sudoku board ").append(std::to_string(index))
+           .append(": ").append(grid).append("\n");
+        return out;
+    }
+
+    const int box = utils::box_of(grid);
+    const int n = box * box;
+
+    // e.g. " -----+-----+-----" for 9x9 grids
+    std::string row_sep;
+    for (int b = 0; b < box; ++b) {
+        row_sep += (b ? '+' : ' ') + std::string(2 * box - 1, '-');
+    }
+
+    out.reserve((n + box) * (4 * n + 2) + 1);
+
+    for (int row = 0; row < n; ++row) {
+
+        if (row && row % box == 0) {
+            out.append(row_sep).append("\t").append(row_sep).append("\n");
+        }
+
+        for (int col = 0; col < n; ++col) {
+            out += (col && col % box == 0 ? '|' : ' ');
+            out += grid[row * n + col];
+        }
+
+        out += '\t';
+
+        for (int col = 0; col < n; ++col) {
+            out += (col && col % box == 0 ? '|' : ' ');
+            out += solution[row * n + col];
         }
-        // joins all threads on destruction
+
+        out += '\n';
     }
 
-    if (unsolved)
-        std::cout << "Puzzles not solved: " << unsolved;
-    else
-        std::cout << "Solved all puzzles";
+    out += '\n';
+    return out;
+}
 
-    return solutions;
+/**
+ * @brief Formats the nb of solutions of a grid for the solutions file: the
+ * grid followed by its count ('2+' when the count reached the limit)
+ *
+ * @param grid Original grid
+ * @param count Nb of solutions of the grid
+ * @param limit Nb of solutions at which the search stopped
+ * @return Formatted record, ending with a new line
+ */
+std::string format_count(std::string_view grid, const int count, const int limit)
+{
+    std::string out(grid);
+    out.append(" ").append(std::to_string(count)).append(count == limit ? "+\n" : "\n");
+    return out;
 }
 
 /**
- * @brief Outputs solutions to file
+ * @brief Solve a batch of sudoku boards concurrently on a thread pool
  *
- * @param grids Original array of grids
- * @param solutions Array of found solutions for each grid
+ * @param grids Array of grids to solve
+ * @param first Index of the first grid in the input
+ * @param solutions Array filled with the solution of each grid, empty if none
+ * @param counts Array filled with the nb of solutions of each grid, in count mode
+ * @param records Array filled with the statistics of each grid, when built in
+ * @param pool Thread pool
+ * @param cache Solution cache, nullptr to always search
+ * @param times Time spent by each backend, added to unless solving with the WFC only
+ * @param out Writer of the solutions file, nullptr if not written
+ * @param tally Nb of puzzles per outcome, added to
+ * @param args Parsed arguments
  */
-void output(const std::vector<std::string>& grids,
-            const std::vector<std::string>& solutions)
+void run(std::span<const std::string_view> grids,
+         const std::size_t first,
+         std::vector<std::string>& solutions,
+         std::vector<int>& counts,
+         std::vector<stats::record>& records,
+         utils::thread_pool& pool,
+         cache::lru* cache,
+         backend_times& times,
+         io::ordered_writer* out,
+         outcomes& tally,
+         const arguments& args)
 {
-    std::ofstream file;
-    file.open("solutions.txt");
+    using sudoku::wfc::status;
 
-    constexpr std::string_view row_sep = " -----+-----+-----";
+    int handed_off = 0;  // Puzzles queued for CP-SAT, not solved yet
+    std::mutex handed_off_mtx;
+    std::condition_variable handed_off_cv;  // Notified with the lock held, so that run() outlives the tasks
+    solutions.assign(grids.size(), "");
+    counts.assign(grids.size(), 0);
 
-    for (int i = 0; i < grids.size(); ++i) {
-        const std::string& grid = grids[i];
-        const std::string& solution = solutions[i];
+    if constexpr (stats::enabled) {
+        records.assign(grids.size(), {});
+    }
 
-        if (solution.empty()) {
-            file << "No solution found for Sudoku board " << i << ": " << grid
-                 << "\n";
-            continue;
+    // With fewer puzzles than threads, puzzles are solved one after
+    // the other, each one split among all the workers
+    // (counting solutions always searches each puzzle on a single worker)
+    const bool split = grids.size() < static_cast<std::size_t>(pool.size()) && !args.count;
+
+    // Portfolios race the copies of each puzzle on the idle workers
+    utils::thread_pool* search_pool = (split || args.portfolio > 1) ? &pool : nullptr;
+
+    backend_times* timing = (args.backend != solver::wfc) ? &times : nullptr;
+
+    // Hands the result of a grid to the writer as soon as it is known
+    auto emit = [&](const int i) {
+        if (!out) {
+            return;
+        }
+        out->push(first + i, args.count ? format_count(grids[i], counts[i], args.count)
+                                        : format(grids[i], solutions[i], first + i, args.format));
+    };
+
+    // Puzzles the WFC gave up on are queued to the pool, so that CP-SAT runs
+    // on whichever worker is free while the others go on with the easy ones
+    auto hand_off = [&](const int i) {
+        {
+            std::scoped_lock lock(handed_off_mtx);
+            handed_off++;
         }
+        pool.enqueue([&, i] {
+            const status result = timed(timing, [&] { return solve_optim(grids[i], solver::cp, solutions[i]); },
+                                        [&](status) -> backend_time& { return times.cp; });
+            tally.add(result);
+
+            if (result == status::solved && cache) {
+                remember<BOX>(grids[i], solutions[i], *cache);
+            }
+
+            if constexpr (stats::enabled) {
+                records[i].solved = (result == status::solved);
+            }
+            emit(i);
+
+            std::scoped_lock lock(handed_off_mtx);
+            if (--handed_off == 0) {
+                handed_off_cv.notify_all();
+            }
+        });
+    };
 
-        for (int row = 0; row < N; ++row) {
+    auto solve_range = [&](const int begin, const int end) {
+        for (int i = begin; i < end; ++i) {
+            const int box = utils::box_of(grids[i]);
 
-            if (row == 3 || row == 6) {
-                file << row_sep << "\t" << row_sep << "\n";
+            if (!box) {
+                // Malformed line
+                tally.malformed++;
+                if constexpr (stats::enabled) {
+                    records[i] = {first + i, false, {}, 0};
+                }
+                emit(i);
+                continue;
+            }
+
+            if (args.seed) {
+                // Same stream for a given puzzle whatever the worker
+                utils::seed(utils::stream_seed(*args.seed, first + i));
             }
 
-            for (int col = 0; col < N; ++col) {
-                file << (col == 3 || col == 6 ? '|' : ' ')
-                     << grid[utils::grid2array(row, col)];
+            const auto start = std::chrono::steady_clock::now();
+            if constexpr (stats::enabled) {
+                stats::take();
+            }
+
+            const solver backend = backend_of(box, args);
+            const sudoku::wfc::solve_options options = make_options(backend, start, args);
+
+            status result = status::unsolvable;
+
+            if (args.count) {
+                with_board(box, args.bitboard, [&](auto board) {
+                    using Board = typename decltype(board)::type;
+
+                    counts[i] = count<Board>(grids[i], args, solutions[i]);
+                    result = counts[i] ? status::solved : status::unsolvable;
+                });
+            } else {
+                result = solve_grid(grids[i], box, options, search_pool, cache, timing, args, solutions[i]);
             }
 
-            file << "\t";
+            if constexpr (stats::enabled) {
+                const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count();
+                records[i] = {first + i, result == status::solved, stats::take(), static_cast<uint64_t>(ns)};
+            }
 
-            for (int col = 0; col < N; ++col) {
-                file << (col == 3 || col == 6 ? '|' : ' ')
-                     << solution[utils::grid2array(row, col)];
+            // Only puzzles over the node budget go to CP-SAT, not the
+            // interrupted ones nor those past their deadline
+            if (result == status::aborted && backend == solver::automatic && !interrupted &&
+                !(options.deadline && std::chrono::steady_clock::now() >= *options.deadline)) {
+                hand_off(i);
+                continue;
             }
 
-            file << "\n";
+            tally.add(result);
+            emit(i);
         }
+    };
+
+    if (split) {
+        solve_range(0, grids.size());
+
+    } else if (args.order == schedule::lpt) {
+        // Estimates every puzzle, then each worker takes the hardest puzzle
+        // left until none is, so that the longest searches start first
+        // instead of stretching the end of the batch
+        std::vector<uint64_t> keys(grids.size());
+        pool.parallel_for(0, grids.size(), [&](const int begin, const int end) {
+            for (int i = begin; i < end; ++i) {
+                keys[i] = estimate(grids[i]);
+            }
+        });
+
+        std::vector<int> order(grids.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](const int a, const int b) {
+            return keys[a] > keys[b];
+        });
+
+        std::atomic_int next = 0;
+        pool.parallel_for(0, pool.size(), [&](int, int) {
+            for (int k = next++; k < static_cast<int>(order.size()); k = next++) {
+                solve_range(order[k], order[k] + 1);
+            }
+        }, 1);
 
-        file << "\n";
+    } else {
+        pool.parallel_for(0, grids.size(), solve_range);
     }
 
-    file.close();
+    std::unique_lock lock(handed_off_mtx);
+    handed_off_cv.wait(lock, [&] { return handed_off == 0; });
+}
+
+/**
+ * @brief Converts text grids to the binary format, or the other way round
+ *
+ * @param input Content of input file
+ * @param path Path to output file
+ * @return Nb of converted grids, -1 on error
+ */
+int convert(std::string_view input, const std::filesystem::path& path)
+{
+    if (codec::is_binary(input)) {
+        const codec::reader records(input);
+
+        if (!records.verify()) {
+            std::cerr << "Corrupted binary file." << std::endl;
+            return -1;
+        }
+
+        std::ofstream file(path, std::ios::binary);
+        if (!file.is_open()) {
+            std::cerr << "Cannot write to '" << path.string() << "'." << std::endl;
+            return -1;
+        }
+
+        std::string buffer;
+        buffer.reserve(1 << 20);
+
+        for (std::size_t i = 0; i < records.size(); ++i) {
+            const std::size_t size = buffer.size();
+            buffer.resize(size + N * N + 1);
+            records.get(i, buffer.data() + size);
+            buffer.back() = '\n';
+
+            if (buffer.size() >= (1 << 20)) {
+                file.write(buffer.data(), buffer.size());
+                buffer.clear();
+            }
+        }
+        file.write(buffer.data(), buffer.size());
+
+        return records.size();
+    }
+
+    codec::writer records(path);
+    if (!records.is_open()) {
+        std::cerr << "Cannot write to '" << path.string() << "'." << std::endl;
+        return -1;
+    }
+
+    io::line_reader reader(input);
+    std::vector<std::string_view> grids;
+    int count = 0;
+
+    while (reader.next(grids, 4096)) {
+        for (const std::string_view grid : grids) {
+            if (utils::box_of(grid) != BOX) {
+                // Only 9x9 grids are packed
+                std::cerr << "Skipped malformed line: " << grid << "\n";
+                continue;
+            }
+            records.write(grid);
+            count++;
+        }
+    }
+
+    return count;
+}
+
+/**
+ * @brief Answers requests until the input is closed or the server
+ * interrupted. The pool, the solver state of each worker and the cache stay
+ * warm from one request to the next
+ *
+ * @param args Parsed arguments
+ * @return Exit code
+ */
+int serve(const arguments& args)
+{
+    using sudoku::wfc::status;
+
+    std::unique_ptr<cache::lru> cache;
+    if (args.cache_mb) {
+        cache = std::make_unique<cache::lru>(args.cache_mb << 20);
+    }
+
+    utils::thread_pool pool(args.nb_threads);
+
+    // Portfolios race the copies of each request on the idle workers
+    utils::thread_pool* search_pool = (args.portfolio > 1) ? &pool : nullptr;
+
+    const server::handler handle = [&](const uint64_t id, std::string_view grid, std::string& solution) {
+        if (args.seed) {
+            // Same stream for a given request id whatever the worker
+            utils::seed(utils::stream_seed(*args.seed, id));
+        }
+
+        const int box = utils::box_of(grid);
+        const solver backend = backend_of(box, args);
+        const sudoku::wfc::solve_options options = make_options(backend, std::chrono::steady_clock::now(), args);
+
+        status result = solve_grid(grid, box, options, search_pool, cache.get(), nullptr, args, solution);
+
+        // Requests over the node budget go to CP-SAT on the same worker
+        if (result == status::aborted && backend == solver::automatic && !interrupted &&
+            !(options.deadline && std::chrono::steady_clock::now() >= *options.deadline)) {
+            result = solve_optim(grid, solver::cp, solution);
+        }
+        return result;
+    };
+
+    std::signal(SIGINT, on_interrupt);
+    std::signal(SIGTERM, on_interrupt);
+
+    // Stdout carries the responses when serving on stdin
+    std::cerr << "Serving on " << (args.serve->empty() ? "stdin" : args.serve->string()) << " with "
+              << args.nb_threads << " threads" << std::endl;
+
+    const bool served = args.serve->empty() ? server::serve_stdio(pool, handle, interrupted)
+                                            : server::serve_socket(*args.serve, pool, handle, interrupted);
+
+    if constexpr (stats::enabled) {
+        if (const stats::histogram waits = pool.interactive_waits(); waits.count()) {
+            std::cerr << "Interactive requests waited: p50 < " << stats::format_ns(waits.percentile(0.50))
+                      << ", p99 < " << stats::format_ns(waits.percentile(0.99))
+                      << ", max " << stats::format_ns(waits.max()) << " before starting\n";
+        }
+    }
+    return served ? 0 : 1;
 }
 
 
 int main(int argc, const char* argv[])
 {
     arguments args;
+    parse(argc, argv, args);
+
+#ifdef ORTOOLS
+    if (!sudoku::optim::configure({args.optim_threads, args.cp_params, args.lp_params})) {
+        std::cerr << "Invalid CP-SAT parameters '" << args.cp_params << "'." << std::endl;
+        exit(1);
+    }
+#endif
+
+    if (args.serve) {
+        return serve(args);
+    }
+
+    // Puzzles are streamed from the mapped file batch by batch
+    // and their solutions written as soon as the batch is solved
+    io::mapped_file input(args.path);
+
+    if (!input.is_open()) {
+        std::cerr << "File '" << args.path << "' not found." << std::endl;
+        exit(1);
+    }
+
+    if (args.convert) {
+        const int count = convert(input.data(), *args.convert);
+        if (count < 0) {
+            exit(1);
+        }
+        std::cout << "Converted " << count << " grids to " << args.convert->string() << "\n";
+        return 0;
+    }
 
-    const auto& grids = parse(argc, argv, args);
+    // Binary inputs are decoded a batch at a time
+    const bool binary = codec::is_binary(input.data());
+    const codec::reader records(input.data());
 
-    std::cout << grids.size() << " sudoku puzzles to solve on "
+    if (binary && !records.verify()) {
+        std::cerr << "Corrupted binary file." << std::endl;
+        exit(1);
+    }
+
+    std::ofstream csv;
+    if (args.stats_csv) {
+        csv.open(*args.stats_csv);
+        stats::write_csv_header(csv);
+    }
+    stats::summary summary;
+
+    backend_times times;
+
+    std::unique_ptr<cache::lru> cache;
+    if (args.cache_mb) {
+        cache = std::make_unique<cache::lru>(args.cache_mb << 20);
+    }
+
+    std::signal(SIGINT, on_interrupt);
+
+    std::cout << "Solving sudoku puzzles of " << args.path.string() << " on "
               << args.nb_threads << " threads\n";
 
     std::chrono::high_resolution_clock::time_point begin =
         std::chrono::high_resolution_clock::now();  // Start chrono
 
-    const auto& solutions = run(grids, args.nb_threads);
+    std::size_t count = 0;
+    outcomes outcome;
+    int invalid = 0;
+    std::vector<std::size_t> tallies(args.count + 1);  // Puzzles per nb of solutions
+
+    {
+        // Solutions are written in input order while the next ones are solved
+        std::optional<io::ordered_writer> writer;
+        if (args.output_solutions) {
+            writer.emplace("solutions.txt");
+        }
+
+        // start concurrency
+        utils::thread_pool pool(args.nb_threads);
+
+        io::line_reader reader(input.data());
+        std::vector<std::string_view> grids;
+        std::vector<std::string> solutions;
+        std::vector<int> counts;
+        std::vector<stats::record> puzzle_stats;
+        std::string decoded;
+
+        auto next_batch = [&]() -> std::size_t {
+            if (!binary) {
+                return reader.next(grids, args.batch_size);
+            }
+
+            const std::size_t size = std::min<std::size_t>(args.batch_size, records.size() - count);
+            decoded.resize(size * N * N);
+            grids.clear();
+
+            for (std::size_t i = 0; i < size; ++i) {
+                records.get(count + i, decoded.data() + i * N * N);
+                grids.emplace_back(decoded.data() + i * N * N, N * N);
+            }
+            return size;
+        };
+
+        while (!interrupted && next_batch()) {
+            run(grids, count, solutions, counts, puzzle_stats, pool, cache.get(), times,
+                writer ? &*writer : nullptr, outcome, args);
+
+            if (args.count) {
+                for (const int c : counts) {
+                    tallies[c]++;
+                }
+            }
+
+            if constexpr (stats::enabled) {
+                for (const stats::record& r : puzzle_stats) {
+                    summary.add(r);
+                    if (args.stats_csv) {
+                        stats::write_csv(csv, r);
+                    }
+                }
+            }
+
+            if (args.verify) {
+                for (std::size_t i = 0; i < grids.size(); ++i) {
+                    if (!solutions[i].empty() && !is_solution(grids[i], solutions[i])) {
+                        invalid++;
+                    }
+                }
+            }
+
+            count += grids.size();
+            input.release(binary ? records.offset(count) : reader.offset());
+        }
+        // joins all threads on destruction, then writes the last solutions
+    }
 
     std::chrono::high_resolution_clock::time_point end =
         std::chrono::high_resolution_clock::now();  // End chrono
 
+    std::cout << count << " sudoku puzzles\n";
+
+    if (static_cast<std::size_t>(outcome.solved) == count)
+        std::cout << "Solved all puzzles";
+    else
+        std::cout << "Solved: " << outcome.solved << ", unsolvable: " << outcome.unsolvable
+                  << ", aborted: " << outcome.aborted << ", malformed: " << outcome.malformed;
+
     std::cout << "\nRun took "
               << std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() * 1.e-6 << "s\n";
 
-    if (args.output_solutions) {
-        output(grids, solutions);
+    if (args.verify) {
+        std::cout << "Invalid solutions: " << invalid << "\n";
+    }
+
+    if (args.backend != solver::wfc) {
+        times.wfc.print(std::cout, "WFC");
+        times.over_budget.print(std::cout, "WFC over budget");
+        times.dlx.print(std::cout, "DLX");
+        times.cp.print(std::cout, "CP-SAT");
+        times.lp.print(std::cout, "MIP");
+    }
+
+    if (cache) {
+        const cache::lru::counters c = cache->get_counters();
+        std::cout << "Cache: " << c.hits << " hits, " << c.misses << " misses ("
+                  << (c.hits + c.misses ? 100. * c.hits / (c.hits + c.misses) : 0.) << "% hit rate), "
+                  << c.entries << " entries in " << (c.bytes >> 10) << " KiB, "
+                  << c.evictions << " evictions\n";
+    }
+
+    if (args.count) {
+        for (int c = 0; c <= args.count; ++c) {
+            if (!tallies[c]) {
+                continue;
+            }
+            std::cout << "Puzzles with " << c << (c == args.count ? "+" : "")
+                      << (c == 1 ? " solution: " : " solutions: ") << tallies[c] << "\n";
+        }
+    }
+
+    if constexpr (stats::enabled) {
+        summary.print(std::cout);
     }
 
     return 0;
@@ -5,196 +5,230 @@
 #include <array>
 #include <iostream>
 #include <memory>
-#include <sstream>
 #include <vector>
 
+#include <google/protobuf/text_format.h>
+
 #include "ortools/linear_solver/linear_solver.h"
 #include "ortools/sat/cp_model.h"
+#include "ortools/sat/cp_model_solver.h"
+#include "ortools/sat/sat_parameters.pb.h"
 
+#include "peers.hpp"
 #include "utils.hpp"
 
 
+namespace sudoku
+{
+
+using namespace operations_research;
+
+namespace
+{
+
+// Read by the solvers of every thread, only written before solving
+optim::settings current;
+sat::SatParameters sat_parameters;
+
 /**
- * @brief A Constraint Programming Sudoku Solver
+ * @brief Builds the CP-SAT model shared by all puzzles: a variable per tile,
+ * whose index is the tile index, and an AllDifferent per unit
  *
- * @param board Sudoku board encoded in string format
- * @return true if solved,
- * @return false if not
+ * @return Model without clues
  */
-bool sudoku::cp::solve(std::string& board)
+sat::CpModelProto make_cp_model()
 {
-    using namespace operations_research;
-    using namespace sat;
-
-    // Constraint Programming Model
-    CpModelBuilder cp_model;
+    sat::CpModelBuilder cp_model;
 
     const Domain digits(1, N);
-    std::array<IntVar, N * N> tiles;
+    std::array<sat::IntVar, N * N> tiles;
 
     for (int idx = 0; idx < N * N; ++idx) {
-        // Create variables
         tiles[idx] = cp_model.NewIntVar(digits);
+    }
+
+    std::vector<sat::IntVar> unit;
+    unit.reserve(N);
 
-        const char c_digit = board[idx];
-        if (c_digit != '.') {
-            // Fix variables to already set digits
-            const int i_digit = c_digit - '0';
-            cp_model.FixVariable(tiles[idx], i_digit);
+    // Rows, cols and boxes
+    for (const auto& members : peers::lookup<BOX>.units) {
+        unit.clear();
+        for (const int idx : members) {
+            unit.push_back(tiles[idx]);
         }
+        // Constraint all values different
+        cp_model.AddAllDifferent(unit);
     }
 
-    // For each row
-    std::vector<IntVar> row;
-    row.reserve(N);
-    for (int i = 0; i < N; ++i)
+    return cp_model.Build();
+}
+
+/**
+ * @brief CP-SAT model of one thread, whose domains are narrowed to the clues
+ * of the puzzle being solved
+ */
+struct cp_workspace {
+    sat::CpModelProto model;
+
+    cp_workspace()
     {
-        row.clear();
-        for (int j = 0; j < N; ++j) {
-            row.push_back(tiles[utils::grid2array(i, j)]);
-        }
-        // Constraint all values different
-        cp_model.AddAllDifferent(row);
+        static const sat::CpModelProto base = make_cp_model();
+        model = base;
     }
+};
 
-    // For each column
-    std::vector<IntVar> col;
-    col.reserve(N);
-    for (int j = 0; j < N; ++j)
+/**
+ * @brief MIP model of one thread, built once: a boolean per tile and digit,
+ * each tile taking exactly one digit and each digit appearing once per unit.
+ * Clues fix the lower bound of their boolean
+ */
+struct lp_workspace {
+    std::unique_ptr<MPSolver> mp_solver;
+    std::array<std::vector<MPVariable*>, N * N> tiles;
+    std::vector<MPVariable*> fixed;  // Booleans fixed by the last puzzle
+
+    lp_workspace()
+        : mp_solver(MPSolver::CreateSolver("SCIP"))
     {
-        col.clear();
-        for (int i = 0; i < N; ++i) {
-            col.push_back(tiles[utils::grid2array(i, j)]);
+        if (!mp_solver) {
+            std::cerr << "SCIP solver unavailable.\n";
+            return;
         }
-        // Constraint all values different
-        cp_model.AddAllDifferent(col);
-    }
 
-    // For each box
-    std::vector<IntVar> box;
-    box.reserve(N);
-    for (int r = 0; r < N; r += BOX) {
-        for (int c = 0; c < N; c += BOX)
-        {
-            box.clear();
-            for (int i = 0; i < BOX; ++i) {
-                for (int j = 0; j < BOX; ++j) {
-                    box.push_back(tiles[utils::grid2array(r + i, c + j)]);
+        if (!mp_solver->SetNumThreads(current.nb_threads).ok() ||
+            !mp_solver->SetSolverSpecificParametersAsString(current.lp_parameters)) {
+            std::cerr << "Invalid MIP parameters.\n";
+            mp_solver.reset();
+            return;
+        }
+
+        for (auto& tile : tiles) {
+            // Create variables
+            mp_solver->MakeBoolVarArray(N, "", &tile);
+
+            LinearExpr sum_digits;
+            for (const auto d : tile) {
+                sum_digits += d;
+            }
+            // Constraint set exactly one value
+            mp_solver->MakeRowConstraint(sum_digits == 1);
+        }
+
+        // For each digit of each row, col and box
+        for (const auto& members : peers::lookup<BOX>.units) {
+            for (int d = 0; d < N; ++d) {
+                LinearExpr sum_unit;
+                for (const int idx : members) {
+                    sum_unit += tiles[idx][d];
                 }
+                // Constraint all values different
+                mp_solver->MakeRowConstraint(sum_unit == 1);
             }
-            // Constraint all values different
-            cp_model.AddAllDifferent(box);
         }
     }
+};
 
-    // Solve
-    const CpSolverResponse response = Solve(cp_model.Build());
+}  // namespace
+
+
+/**
+ * @brief Sets the parameters of the solvers. Must be called before the first
+ * solve, as each thread builds its solvers once
+ *
+ * @param s Settings
+ * @return true if the parameters are valid,
+ * @return false if not
+ */
+bool optim::configure(const settings& s)
+{
+    current = s;
 
-    if (response.status() != CpSolverStatus::OPTIMAL &&
-        response.status() != CpSolverStatus::FEASIBLE) {
+    sat_parameters.Clear();
+    if (!google::protobuf::TextFormat::MergeFromString(s.cp_parameters, &sat_parameters)) {
         return false;
     }
-
-    // Output
-    std::ostringstream oss;
-    for (const auto& tile : tiles) {
-        oss << SolutionIntegerValue(response, tile);
+    if (!sat_parameters.has_num_search_workers()) {
+        sat_parameters.set_num_search_workers(s.nb_threads);
     }
-    board = oss.str();
-
     return true;
 }
 
 
 /**
- * @brief A Mixed Integer Linear Programming Sudoku Solver
+ * @brief A Constraint Programming Sudoku Solver. The model is built once per
+ * thread, each puzzle only fixing the domains of its clues
  *
  * @param board Sudoku board encoded in string format
  * @return true if solved,
  * @return false if not
  */
-bool sudoku::lp::solve(std::string& board)
+bool cp::solve(std::string& board)
 {
-    using namespace operations_research;
+    thread_local cp_workspace ws;
 
-    // Mixed Integer Linear Programming Model
-    std::unique_ptr<MPSolver> mp_solver(MPSolver::CreateSolver("SCIP"));
+    for (int idx = 0; idx < N * N; ++idx) {
+        // Fix variables to already set digits, free the others
+        // Digits too large for the grid are blanks
+        const int digit = utils::to_digit(board[idx]);
+        const bool clue = digit && digit <= N;
+
+        sat::IntegerVariableProto* var = ws.model.mutable_variables(idx);
+        var->clear_domain();
+        var->add_domain(clue ? digit : 1);
+        var->add_domain(clue ? digit : N);
+    }
 
-    if (!mp_solver) {
-        std::cerr << "SCIP solver unavailable.\n";
+    // Solve
+    const sat::CpSolverResponse response = sat::SolveWithParameters(ws.model, sat_parameters);
+
+    if (response.status() != sat::CpSolverStatus::OPTIMAL &&
+        response.status() != sat::CpSolverStatus::FEASIBLE) {
         return false;
     }
 
-    std::array<std::vector<MPVariable*>, N * N> tiles;
-
+    // Output
     for (int idx = 0; idx < N * N; ++idx) {
-        // Create variables
-        mp_solver->MakeBoolVarArray(N, "", &tiles[idx]);
+        board[idx] = utils::to_char(response.solution(idx));
+    }
 
-        const char c_digit = board[idx];
-        if (c_digit != '.') {
-            const int i_digit = c_digit - '0';
+    return true;
+}
 
-            // Constraint set value
-            LinearExpr tile_set{tiles[idx][i_digit - 1]};
-            mp_solver->MakeRowConstraint(tile_set == 1);
-        }
-    }
 
-    // For each tile
-    for (const auto tile : tiles)
-    {
-        LinearExpr sum_digits;
-        for (const auto d : tile) {
-            sum_digits += d;
-        }
-        // Constraint set exactly one value
-        mp_solver->MakeRowConstraint(sum_digits == 1);
-    }
+/**
+ * @brief A Mixed Integer Linear Programming Sudoku Solver. The model is built
+ * once per thread, each puzzle only fixing the booleans of its clues
+ *
+ * @param board Sudoku board encoded in string format
+ * @return true if solved,
+ * @return false if not
+ */
+bool lp::solve(std::string& board)
+{
+    thread_local lp_workspace ws;
 
-    // For each digit
-    for (int d = 0; d < N; ++d)
-    {
-        // For each row
-        for (int i = 0; i < N; ++i)
-        {
-            LinearExpr sum_col;
-            for (int j = 0; j < N; ++j) {
-                sum_col += tiles[utils::grid2array(i, j)][d];
-            }
-            // Constraint all values different
-            mp_solver->MakeRowConstraint(sum_col == 1);
-        }
+    if (!ws.mp_solver) {
+        return false;
+    }
 
-        // For each column
-        for (int j = 0; j < N; ++j)
-        {
-            LinearExpr sum_row;
-            for (int i = 0; i < N; ++i) {
-                sum_row += tiles[utils::grid2array(i, j)][d];
-            }
-            // Constraint all values different
-            mp_solver->MakeRowConstraint(sum_row == 1);
-        }
+    // Free the clues of the last puzzle
+    for (MPVariable* var : ws.fixed) {
+        var->SetLB(0);
+    }
+    ws.fixed.clear();
 
-        // For each box
-        for (int r = 0; r < N; r += BOX) {
-            for (int c = 0; c < N; c += BOX)
-            {
-                LinearExpr sum_box;
-                for (int i = 0; i < BOX; ++i) {
-                    for (int j = 0; j < BOX; ++j) {
-                        sum_box += tiles[utils::grid2array(i, j)][d];
-                    }
-                }
-                // Constraint all values different
-                mp_solver->MakeRowConstraint(sum_box == 1);
-            }
+    for (int idx = 0; idx < N * N; ++idx) {
+        const int digit = utils::to_digit(board[idx]);
+        if (digit && digit <= N) {
+            // Constraint set value
+            MPVariable* var = ws.tiles[idx][digit - 1];
+            var->SetLB(1);
+            ws.fixed.push_back(var);
         }
     }
 
     // Solve
-    const MPSolver::ResultStatus result = mp_solver->Solve();
+    const MPSolver::ResultStatus result = ws.mp_solver->Solve();
 
     if (result != MPSolver::OPTIMAL &&
         result != MPSolver::FEASIBLE) {
@@ -202,18 +236,18 @@ bool sudoku::lp::solve(std::string& board)
     }
 
     // Output
-    std::ostringstream oss;
-    for (const auto& tile : tiles) {
+    for (int idx = 0; idx < N * N; ++idx) {
         for (int d = 0; d < N; ++d) {
-            if (tile[d]->solution_value() > 0) {
-                oss << d + 1;
+            if (ws.tiles[idx][d]->solution_value() > 0.5) {
+                board[idx] = utils::to_char(d + 1);
                 break;
             }
         }
     }
-    board = oss.str();
 
     return true;
 }
 
+}  // namespace sudoku
+
 #endif
@@ -7,6 +7,19 @@
 namespace sudoku
 {
 
+namespace optim
+{
+
+struct settings {
+    int nb_threads = 1;         // Search workers of each solve, puzzles already run in parallel
+    std::string cp_parameters;  // CP-SAT parameters, in protobuf text format
+    std::string lp_parameters;  // MIP solver specific parameters
+};
+
+bool configure(const settings& s);
+
+}  // namespace optim
+
 namespace cp
 {
 bool solve(std::string& board);
@@ -19,4 +32,4 @@ bool solve(std::string& board);
 
 }  // namespace sudoku
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <type_traits>
+
+#include "utils.hpp"
+
+
+namespace sudoku
+{
+
+namespace peers
+{
+
+template <int Box>
+inline constexpr int nb_peers = 3 * (Box * Box - 1) - 2 * (Box - 1);  // Unique peers of a tile
+
+template <int Box>
+inline constexpr int nb_units = 3 * Box * Box;  // Rows, then cols, then boxes
+
+template <int Box>
+inline constexpr int nb_intersections = 2 * Box * Box * Box;  // Each box with each of its rows and cols
+
+template <int Box>
+using index_t = std::conditional_t<(utils::dims<Box>::tiles <= 256), uint8_t, uint16_t>;
+
+/**
+ * @brief Compile-time lookup of the peers of every tile and of the members of
+ * every unit (row, col and box). Read-only, hence shared by all threads.
+ */
+template <int Box>
+struct alignas(64) table {
+    using dims = utils::dims<Box>;
+    using index = index_t<Box>;
+
+    std::array<std::array<index, nb_peers<Box>>, dims::tiles> peers;  // Peers of each tile
+    std::array<std::array<index, dims::n>, nb_units<Box>> units;      // Members of each unit
+    std::array<std::array<index, 3>, dims::tiles> units_of;            // Row, col and box unit of each tile
+
+    // Tiles shared by a box and a row or col, the rest of the line and the rest of the box
+    std::array<std::array<index, Box>, nb_intersections<Box>> intersections;
+    std::array<std::array<index, dims::n - Box>, nb_intersections<Box>> line_rests;
+    std::array<std::array<index, dims::n - Box>, nb_intersections<Box>> box_rests;
+};
+
+/**
+ * @brief Builds the peer table. Peers are listed in increasing order, row by
+ * row: the whole row of the tile, the rest of its box and the rest of its col
+ *
+ * @return Filled table
+ */
+template <int Box>
+constexpr table<Box> make_table()
+{
+    using index = index_t<Box>;
+    constexpr int n = utils::dims<Box>::n;
+
+    table<Box> t{};
+
+    for (int idx = 0; idx < n * n; ++idx) {
+        const int i = idx / n;
+        const int j = idx % n;
+        const int b = (i / Box) * Box + (j / Box);
+
+        t.units[i][j] = idx;
+        t.units[n + j][i] = idx;
+        t.units[2 * n + b][(i % Box) * Box + (j % Box)] = idx;
+
+        t.units_of[idx] = {static_cast<index>(i),
+                           static_cast<index>(n + j),
+                           static_cast<index>(2 * n + b)};
+    }
+
+    for (int idx = 0; idx < n * n; ++idx) {
+        const int i = idx / n;
+        const int j = idx % n;
+        const int box_col = (j / Box) * Box;
+
+        int count = 0;
+        for (int r = 0; r < n; ++r) {
+            if (r == i) {
+                // Same row
+                for (int c = 0; c < n; ++c) {
+                    if (c != j) {
+                        t.peers[idx][count++] = r * n + c;
+                    }
+                }
+
+            } else if (r / Box == i / Box) {
+                // Same box, col of the tile included
+                for (int c = box_col; c < box_col + Box; ++c) {
+                    t.peers[idx][count++] = r * n + c;
+                }
+
+            } else {
+                // Same col
+                t.peers[idx][count++] = r * n + j;
+            }
+        }
+    }
+
+    int inter = 0;
+    for (int b = 0; b < n; ++b) {
+        const int box_row = (b / Box) * Box;
+        const int box_col = (b % Box) * Box;
+
+        // Rows of the box, then its cols
+        for (int line = 0; line < 2 * Box; ++line) {
+            const bool is_row = line < Box;
+            const int l = is_row ? box_row + line : box_col + line - Box;
+
+            int nb_inter = 0, nb_line = 0, nb_box = 0;
+
+            for (int k = 0; k < n; ++k) {
+                // k-th tile of the line
+                const int idx = is_row ? l * n + k : k * n + l;
+                const int along = is_row ? k - box_col : k - box_row;
+
+                if (along >= 0 && along < Box) {
+                    t.intersections[inter][nb_inter++] = idx;
+                } else {
+                    t.line_rests[inter][nb_line++] = idx;
+                }
+            }
+
+            for (const index idx : t.units[2 * n + b]) {
+                const int across = is_row ? idx / n : idx % n;
+
+                if (across != l) {
+                    t.box_rests[inter][nb_box++] = idx;
+                }
+            }
+            ++inter;
+        }
+    }
+
+    return t;
+}
+
+template <int Box>
+inline constexpr table<Box> lookup = make_table<Box>();
+
+static_assert(lookup<3>.peers[0][nb_peers<3> - 1] != 0, "Peer table is not full");
+
+}  // namespace peers
+
+}  // namespace sudoku
@@ -0,0 +1,472 @@
+#include "server.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <iostream>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "stats.hpp"
+
+#if __has_include(<sys/socket.h>) && __has_include(<poll.h>)
+#include <cerrno>
+#include <csignal>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#define SERVER_POSIX
+#endif
+
+
+namespace server
+{
+
+/**
+ * @brief Name of a status in text responses
+ *
+ * @param s Status
+ * @return Name
+ */
+std::string_view name(const status s)
+{
+    switch (s) {
+    case status::solved:
+        return "solved";
+    case status::unsolvable:
+        return "unsolvable";
+    case status::aborted:
+        return "aborted";
+    default:
+        return "malformed";
+    }
+}
+
+#ifdef SERVER_POSIX
+
+namespace
+{
+
+constexpr int poll_ms = 100;                   // Period at which idle reads check the stop flag
+constexpr std::size_t read_size = 1 << 16;
+constexpr std::size_t max_in_flight = 4096;    // Requests read but not answered, per connection
+
+/**
+ * @brief Writes a whole buffer, without raising SIGPIPE on sockets closed by
+ * the client (stdout relies on SIGPIPE being ignored, see serve_stdio())
+ *
+ * @param fd Descriptor
+ * @param socket Socket flag
+ * @param data Buffer
+ * @return false once the client is gone
+ */
+bool write_all(const int fd, const bool socket, std::string_view data)
+{
+    while (!data.empty()) {
+        const ssize_t n = socket ? ::send(fd, data.data(), data.size(), MSG_NOSIGNAL)
+                                 : ::write(fd, data.data(), data.size());
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // e.g. EPIPE once the client closed its end
+            return false;
+        }
+        data.remove_prefix(n);
+    }
+    return true;
+}
+
+/**
+ * @brief One client: requests read from one descriptor by the calling thread,
+ * solved on the pool, and answered on another descriptor by the workers
+ */
+class connection final
+{
+public:
+    connection(const int in, const int out, const bool socket, utils::thread_pool& pool, const handler& solve)
+        : _in(in), _out(out), _socket(socket), _pool(pool), _solve(solve)
+    {
+    }
+
+    void run(const std::atomic_bool& stop);
+
+private:
+    void consume(std::string& pending, const bool last);
+    void dispatch(const uint64_t id,
+                  std::string grid,
+                  const bool binary,
+                  const utils::priority p,
+                  const std::optional<utils::thread_pool::clock::time_point> deadline);
+    void respond(const uint64_t id, const status s, std::string_view solution, const bool binary,
+                 const std::chrono::steady_clock::time_point received);
+
+    const int _in;
+    const int _out;
+    const bool _socket;
+    utils::thread_pool& _pool;
+    const handler& _solve;
+
+    uint64_t _lines = 0;  // Text lines read, default id of the next one
+
+    std::mutex _flight_mtx;
+    std::condition_variable _flight_cv;  // Notified with the lock held, so that run() outlives the workers
+    std::size_t _in_flight = 0;
+
+    std::mutex _mtx;                   // Guards the output and the latencies
+    std::atomic_bool _closed = false;  // Client stopped reading, responses dropped and no more requests read
+    stats::histogram _latencies;
+};
+
+/**
+ * @brief Reads and dispatches requests until the input is closed or the stop
+ * flag raised, then waits for the answers of the requests in flight
+ *
+ * @param stop Stop flag
+ */
+void connection::run(const std::atomic_bool& stop)
+{
+    std::string pending;
+    std::vector<char> chunk(read_size);
+
+    while (!stop && !_closed) {
+        pollfd fd{_in, POLLIN, 0};
+        const int ready = ::poll(&fd, 1, poll_ms);
+
+        if (ready < 0 && errno != EINTR) {
+            break;
+        }
+        if (ready <= 0) {
+            continue;
+        }
+
+        const ssize_t n = ::read(_in, chunk.data(), chunk.size());
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+
+        pending.append(chunk.data(), n);
+        consume(pending, false);
+    }
+
+    if (!stop && !_closed) {
+        // A last line without a new line is still a request
+        consume(pending, true);
+    }
+
+    {
+        std::unique_lock lock(_flight_mtx);
+        _flight_cv.wait(lock, [this] { return _in_flight == 0; });
+    }
+
+    if (_latencies.count()) {
+        std::cerr << "Served " << _latencies.count() << " requests: p50 < "
+                  << stats::format_ns(_latencies.percentile(0.50)) << ", p99 < "
+                  << stats::format_ns(_latencies.percentile(0.99)) << ", max "
+                  << stats::format_ns(_latencies.max()) << std::endl;
+    }
+}
+
+/**
+ * @brief Dispatches the complete requests at the front of the input
+ *
+ * @param pending Input read and not consumed yet, complete requests removed
+ * @param last No more input will follow
+ */
+void connection::consume(std::string& pending, const bool last)
+{
+    std::size_t pos = 0;
+
+    while (pos < pending.size()) {
+        if (const uint8_t marker = pending[pos]; marker == frame_marker || marker == interactive_marker) {
+            if (pending.size() - pos < request_frame_size) {
+                break;
+            }
+
+            uint64_t id;
+            std::memcpy(&id, pending.data() + pos + 1, sizeof(id));
+
+            std::string grid(N * N, '.');
+            codec::decode(reinterpret_cast<const uint8_t*>(pending.data() + pos + 9), grid.data());
+
+            dispatch(id, std::move(grid), true,
+                     marker == interactive_marker ? utils::priority::interactive : utils::priority::batch, {});
+            pos += request_frame_size;
+            continue;
+        }
+
+        std::size_t eol = pending.find('\n', pos);
+        if (eol == std::string::npos) {
+            if (!last) {
+                break;
+            }
+            eol = pending.size();
+        }
+
+        std::string_view line(pending.data() + pos, eol - pos);
+        pos = eol + 1;
+
+        if (line.ends_with('\r')) {
+            line.remove_suffix(1);
+        }
+        if (line.empty()) {
+            continue;
+        }
+
+        uint64_t id = _lines++;
+        utils::priority p = utils::priority::batch;
+        std::optional<utils::thread_pool::clock::time_point> deadline;
+
+        if (const std::size_t space = line.find(' '); space != std::string_view::npos) {
+            // e.g. "42", "42!" or "42!50"
+            const std::string_view tag = line.substr(0, space);
+            line.remove_prefix(space + 1);
+
+            const char* const last = tag.data() + tag.size();
+            uint64_t tagged;
+            std::from_chars_result parsed = std::from_chars(tag.data(), last, tagged);
+
+            if (parsed.ec == std::errc() && parsed.ptr != last && *parsed.ptr == '!') {
+                p = utils::priority::interactive;
+
+                if (++parsed.ptr != last) {
+                    uint64_t ms;
+                    parsed = std::from_chars(parsed.ptr, last, ms);
+                    deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+                }
+            }
+
+            if (parsed.ec != std::errc() || parsed.ptr != last) {
+                respond(id, status::malformed, "", false, std::chrono::steady_clock::now());
+                continue;
+            }
+            id = tagged;
+        }
+
+        if (!utils::box_of(line)) {
+            respond(id, status::malformed, "", false, std::chrono::steady_clock::now());
+            continue;
+        }
+
+        dispatch(id, std::string(line), false, p, deadline);
+    }
+
+    pending.erase(0, std::min(pos, pending.size()));
+}
+
+/**
+ * @brief Queues a request to the pool, waiting first while too many requests
+ * of the connection are in flight
+ *
+ * @param id Request id
+ * @param grid Grid
+ * @param binary Answer with a binary frame
+ * @param p Class of the request
+ * @param deadline Time an interactive request should start by, if any
+ */
+void connection::dispatch(const uint64_t id,
+                          std::string grid,
+                          const bool binary,
+                          const utils::priority p,
+                          const std::optional<utils::thread_pool::clock::time_point> deadline)
+{
+    const auto received = std::chrono::steady_clock::now();
+
+    {
+        std::unique_lock lock(_flight_mtx);
+        _flight_cv.wait(lock, [this] { return _in_flight < max_in_flight; });
+        _in_flight++;
+    }
+
+    _pool.enqueue([this, id, grid = std::move(grid), binary, received] {
+        std::string solution;
+        const sudoku::wfc::status result = _solve(id, grid, solution);
+
+        const status s = result == sudoku::wfc::status::solved       ? status::solved
+                       : result == sudoku::wfc::status::unsolvable   ? status::unsolvable
+                                                                     : status::aborted;
+        respond(id, s, solution, binary, received);
+
+        std::scoped_lock lock(_flight_mtx);
+        _in_flight--;
+        _flight_cv.notify_all();
+    }, p, deadline);
+}
+
+/**
+ * @brief Writes the response of a request
+ *
+ * @param id Request id
+ * @param s Status
+ * @param solution Solution, empty if none
+ * @param binary Answer with a binary frame
+ * @param received Time the request was read
+ */
+void connection::respond(const uint64_t id,
+                         const status s,
+                         std::string_view solution,
+                         const bool binary,
+                         const std::chrono::steady_clock::time_point received)
+{
+    const uint64_t latency = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - received).count();
+
+    std::string out;
+
+    if (binary) {
+        out.resize(response_frame_size);
+        out[0] = static_cast<char>(frame_marker);
+        std::memcpy(out.data() + 1, &id, sizeof(id));
+        out[9] = static_cast<char>(s);
+        std::memcpy(out.data() + 10, &latency, sizeof(latency));
+
+        const std::string blank(N * N, '.');
+        codec::encode(solution.empty() ? blank : solution, reinterpret_cast<uint8_t*>(out.data() + 18));
+    } else {
+        // e.g. "<id> solved <solution> <latency>"
+        out.append(std::to_string(id)).append(" ").append(name(s)).append(" ")
+           .append(solution.empty() ? "-" : solution).append(" ").append(std::to_string(latency)).append("\n");
+    }
+
+    std::scoped_lock lock(_mtx);
+
+    _latencies.add(latency);
+    if (!_closed) {
+        _closed = !write_all(_out, _socket, out);
+    }
+}
+
+}  // namespace
+
+
+/**
+ * @brief Answers the requests read on stdin on stdout, until stdin is closed
+ * or the stop flag raised
+ *
+ * @param pool Pool solving the requests
+ * @param solve Solver of one grid
+ * @param stop Stop flag
+ * @return true
+ */
+bool serve_stdio(utils::thread_pool& pool, const handler& solve, const std::atomic_bool& stop)
+{
+    // A closed stdout fails the writes with EPIPE, i.e. the client is gone,
+    // instead of killing the process
+    std::signal(SIGPIPE, SIG_IGN);
+
+    connection client(STDIN_FILENO, STDOUT_FILENO, false, pool, solve);
+    client.run(stop);
+    return true;
+}
+
+/**
+ * @brief Answers the requests of the clients of a Unix socket, each one read
+ * by its own thread, until the stop flag is raised
+ *
+ * @param path Path of the socket, replaced if a socket is already there
+ * @param pool Pool solving the requests of all the clients
+ * @param solve Solver of one grid
+ * @param stop Stop flag
+ * @return false if the socket cannot be opened
+ */
+bool serve_socket(const std::filesystem::path& path,
+                  utils::thread_pool& pool,
+                  const handler& solve,
+                  const std::atomic_bool& stop)
+{
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+
+    if (path.native().size() >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path '" << path.string() << "' is too long." << std::endl;
+        return false;
+    }
+    std::strcpy(address.sun_path, path.c_str());
+
+    // Socket left by a previous run
+    if (std::filesystem::is_socket(path)) {
+        std::filesystem::remove(path);
+    }
+
+    const int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (listener < 0 ||
+        ::bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0 ||
+        ::listen(listener, SOMAXCONN) < 0) {
+        std::cerr << "Cannot listen on '" << path.string() << "': " << std::strerror(errno) << std::endl;
+        if (listener >= 0) {
+            ::close(listener);
+        }
+        return false;
+    }
+
+    struct client {
+        std::thread thread;
+        std::atomic_bool done = false;
+    };
+    std::list<client> clients;
+
+    while (!stop) {
+        // Joins the clients that left
+        clients.remove_if([](client& c) {
+            if (!c.done) {
+                return false;
+            }
+            c.thread.join();
+            return true;
+        });
+
+        pollfd fd{listener, POLLIN, 0};
+        if (::poll(&fd, 1, poll_ms) <= 0) {
+            continue;
+        }
+
+        const int socket = ::accept(listener, nullptr, nullptr);
+        if (socket < 0) {
+            continue;
+        }
+
+        client& c = clients.emplace_back();
+        c.thread = std::thread([&, socket] {
+            connection(socket, socket, true, pool, solve).run(stop);
+            ::close(socket);
+            c.done = true;
+        });
+    }
+
+    for (client& c : clients) {
+        c.thread.join();
+    }
+
+    ::close(listener);
+    std::filesystem::remove(path);
+    return true;
+}
+
+#else
+
+bool serve_stdio(utils::thread_pool&, const handler&, const std::atomic_bool&)
+{
+    std::cerr << "Serving needs POSIX sockets." << std::endl;
+    return false;
+}
+
+bool serve_socket(const std::filesystem::path&, utils::thread_pool&, const handler&, const std::atomic_bool&)
+{
+    std::cerr << "Serving needs POSIX sockets." << std::endl;
+    return false;
+}
+
+#endif
+
+}  // namespace server
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <string_view>
+
+#include "codec.hpp"
+#include "sudoku.hpp"
+#include "utils.hpp"
+
+
+/**
+ * @brief Long running solver answering requests on stdin or on a Unix socket.
+ * Requests are pipelined: each one is queued to the pool as soon as it is
+ * read, and its response written as soon as it is solved, tagged with its id,
+ * so responses come back in completion order.
+ *
+ * Text requests are lines '[<id>[!<ms>] ]<grid>', the id defaulting to the
+ * index of the line on the connection. A '!' makes the request interactive,
+ * optionally to be started within ms milliseconds. Text responses are lines
+ * '<id> <status> <solution or -> <latency_ns>'.
+ *
+ * Binary requests are frames of a marker byte, batch or interactive, the id
+ * on 8 bytes and a 9x9 grid packed as a codec record. Binary responses are
+ * frames of the batch marker, the id, the status on 1 byte, the latency on 8
+ * bytes and the packed solution, blank if none. Integers are in host byte
+ * order, both ends sharing the machine.
+ *
+ * Interactive requests are solved before the batch ones, earliest deadline
+ * first (see utils::thread_pool).
+ *
+ * The latency runs from the request being read to its response being ready,
+ * waiting for a worker included
+ */
+namespace server
+{
+
+enum class status : uint8_t {
+    solved,
+    unsolvable,
+    aborted,
+    malformed,  // Not a grid, never searched
+};
+
+inline constexpr uint8_t frame_marker = 0xB5;        // Never starts a text line
+inline constexpr uint8_t interactive_marker = 0xB6;  // Request frame of an interactive request
+inline constexpr std::size_t request_frame_size = 1 + 8 + codec::record_size;
+inline constexpr std::size_t response_frame_size = 1 + 8 + 1 + 8 + codec::record_size;
+
+std::string_view name(const status s);
+
+// Solves a grid on a worker, filling the solution, empty if none
+using handler = std::function<sudoku::wfc::status(uint64_t id, std::string_view grid, std::string& solution)>;
+
+bool serve_stdio(utils::thread_pool& pool, const handler& solve, const std::atomic_bool& stop);
+bool serve_socket(const std::filesystem::path& path,
+                  utils::thread_pool& pool,
+                  const handler& solve,
+                  const std::atomic_bool& stop);
+
+}  // namespace server
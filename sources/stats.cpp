@@ -0,0 +1,144 @@
+#include "stats.hpp"
+
+#include <cmath>
+#include <iomanip>
+#include <string>
+
+
+namespace stats
+{
+
+/**
+ * @brief Human readable duration
+ *
+ * @param ns Duration in ns
+ * @return Duration with its unit
+ */
+std::string format_ns(const uint64_t ns)
+{
+    constexpr std::array<const char*, 4> units = {"ns", "us", "ms", "s"};
+
+    double value = ns;
+    int unit = 0;
+    for (; value >= 1000 && unit < 3; ++unit) {
+        value /= 1000;
+    }
+
+    std::string s = std::to_string(value);
+    s.resize(s.find('.') + (value < 10 ? 3 : value < 100 ? 2 : 0));
+    if (s.back() == '.') {
+        s.pop_back();
+    }
+    return s + units[unit];
+}
+
+
+/**
+ * @brief Adds the latencies of another histogram
+ *
+ * @param o Other histogram
+ */
+void histogram::merge(const histogram& o)
+{
+    for (int b = 0; b < nb_buckets; ++b) {
+        _buckets[b] += o._buckets[b];
+    }
+    _count += o._count;
+    _max = std::max(_max, o._max);
+}
+
+/**
+ * @brief Upper bound of the bucket holding the quantile
+ *
+ * @param q Quantile in [0, 1]
+ * @return Latency in ns, at most the max
+ */
+uint64_t histogram::percentile(const double q) const
+{
+    const uint64_t rank = std::max<uint64_t>(1, std::ceil(q * _count));
+    uint64_t seen = 0;
+
+    for (int b = 0; b < nb_buckets; ++b) {
+        seen += _buckets[b];
+        if (seen >= rank) {
+            return std::min(_max, (uint64_t{2} << b) - 1);
+        }
+    }
+    return _max;
+}
+
+/**
+ * @brief Prints one line per non-empty bucket, with a bar proportional to
+ * its count
+ *
+ * @param os Output stream
+ */
+void histogram::print(std::ostream& os) const
+{
+    constexpr int width = 40;
+
+    const uint64_t largest = *std::max_element(_buckets.begin(), _buckets.end());
+
+    for (int b = 0; b < nb_buckets; ++b) {
+        if (!_buckets[b]) {
+            continue;
+        }
+
+        const int bar = std::max<uint64_t>(1, _buckets[b] * width / largest);
+        os << "  [" << std::setw(7) << format_ns(uint64_t{1} << b) << ", "
+           << std::setw(7) << format_ns(uint64_t{2} << b) << ") "
+           << std::setw(9) << _buckets[b] << " " << std::string(bar, '#') << "\n";
+    }
+}
+
+
+/**
+ * @brief Accounts for a puzzle
+ *
+ * @param r Statistics of the puzzle
+ */
+void summary::add(const record& r)
+{
+    if (!_latencies.count() || r.ns > _slowest.ns) {
+        _slowest = r;
+    }
+    _totals += r.search;
+    _latencies.add(r.ns);
+}
+
+/**
+ * @brief Prints the totals, the latency percentiles and the histogram
+ *
+ * @param os Output stream
+ */
+void summary::print(std::ostream& os) const
+{
+    const uint64_t count = std::max<uint64_t>(1, _latencies.count());
+
+    os << "Nodes: " << _totals.nodes << " (" << _totals.nodes / count << "/puzzle)"
+       << ", backtracks: " << _totals.backtracks << " (" << _totals.backtracks / count << "/puzzle)"
+       << ", cascades: " << _totals.cascades << " (" << _totals.cascades / count << "/puzzle)"
+       << ", max depth: " << _totals.max_depth << "\n";
+
+    os << "Latency: p50 < " << format_ns(_latencies.percentile(0.50))
+       << ", p99 < " << format_ns(_latencies.percentile(0.99))
+       << ", max " << format_ns(_latencies.max())
+       << " (puzzle " << _slowest.puzzle << ", " << _slowest.search.nodes << " nodes)\n";
+
+    _latencies.print(os);
+}
+
+
+void write_csv_header(std::ostream& os)
+{
+    os << "puzzle,solved,nodes,backtracks,cascades,max_depth,ns\n";
+}
+
+void write_csv(std::ostream& os, const record& r)
+{
+    os << r.puzzle << ',' << r.solved << ',' << r.search.nodes << ','
+       << r.search.backtracks << ',' << r.search.cascades << ','
+       << r.search.max_depth << ',' << r.ns << '\n';
+}
+
+}  // namespace stats
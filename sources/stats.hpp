@@ -0,0 +1,155 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+#include "bit_manipulation.hpp"
+
+
+namespace stats
+{
+
+// Instrumentation is compiled out unless built with WFC_STATS
+#if defined(WFC_STATS)
+inline constexpr bool enabled = true;
+#else
+inline constexpr bool enabled = false;
+#endif
+
+/**
+ * @brief Search counters of one puzzle
+ */
+struct counters {
+    uint64_t nodes = 0;       // Search states expanded
+    uint64_t backtracks = 0;  // Branches that ended in a contradiction
+    uint64_t cascades = 0;    // Collapses forced by propagation or inference
+    uint64_t max_depth = 0;   // Deepest decision level
+
+    inline counters& operator+=(const counters& o)
+    {
+        nodes += o.nodes;
+        backtracks += o.backtracks;
+        cascades += o.cascades;
+        max_depth = std::max(max_depth, o.max_depth);
+        return *this;
+    }
+};
+
+/**
+ * @brief Counters of the calling thread, so that workers never share them
+ *
+ * @return Reference to the thread's counters
+ */
+inline counters& local()
+{
+    thread_local counters c;
+    return c;
+}
+
+inline void node()      { if constexpr (enabled) { local().nodes++; } }
+inline void backtrack() { if constexpr (enabled) { local().backtracks++; } }
+inline void cascade()   { if constexpr (enabled) { local().cascades++; } }
+
+inline void depth(const uint64_t d)
+{
+    if constexpr (enabled) {
+        local().max_depth = std::max(local().max_depth, d);
+    }
+}
+
+/**
+ * @brief Hands out the counters of the calling thread and resets them
+ *
+ * @return Counters since the last call
+ */
+inline counters take()
+{
+    if constexpr (!enabled) {
+        return {};
+    }
+
+    const counters c = local();
+    local() = {};
+    return c;
+}
+
+/**
+ * @brief Adds counters gathered elsewhere, e.g. on other threads, to the ones
+ * of the calling thread
+ *
+ * @param c Counters
+ */
+inline void add(const counters& c)
+{
+    if constexpr (enabled) {
+        local() += c;
+    }
+}
+
+
+/**
+ * @brief Latencies counted in power of two buckets: bucket b holds the values
+ * in [2^b, 2^(b+1))
+ */
+class histogram final
+{
+public:
+    static constexpr int nb_buckets = 64;
+
+    inline void add(const uint64_t ns)
+    {
+        _buckets[ns ? bit::highest(ns) : 0]++;
+        _count++;
+        _max = std::max(_max, ns);
+    }
+
+    void merge(const histogram& o);
+
+    inline uint64_t count() const { return _count; }
+    inline uint64_t max() const { return _max; }
+    uint64_t percentile(const double q) const;
+
+    void print(std::ostream& os) const;
+
+private:
+    std::array<uint64_t, nb_buckets> _buckets{};
+    uint64_t _count = 0;
+    uint64_t _max = 0;
+};
+
+
+/**
+ * @brief Statistics of one puzzle
+ */
+struct record {
+    std::size_t puzzle;  // Index in the input
+    bool solved;
+    counters search;
+    uint64_t ns;         // Wall time
+};
+
+/**
+ * @brief Totals and latency histogram of all the puzzles of a run
+ */
+class summary final
+{
+public:
+    void add(const record& r);
+    void print(std::ostream& os) const;
+
+private:
+    counters _totals;
+    histogram _latencies;
+    record _slowest{};
+};
+
+std::string format_ns(const uint64_t ns);
+
+void write_csv_header(std::ostream& os);
+void write_csv(std::ostream& os, const record& r);
+
+}  // namespace stats
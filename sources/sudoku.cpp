@@ -1,8 +1,17 @@
 #include "sudoku.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
 #include <optional>
+#include <span>
 #include <stack>
+#include <vector>
 
+#include "limits.hpp"
+#include "stats.hpp"
 #include "utils.hpp"
 
 
@@ -10,120 +19,712 @@ namespace sudoku
 {
 
 /**
- * @brief Initialises sudoku solver by pre-computing peers
+ * @brief Chooses randomly a tile among the candidates
  *
+ * @param candidates Non-empty set of tiles
+ * @return Tile index
  */
-void wfc::init()
+template <int Size>
+int sample(const bit::index_set<Size>& candidates)
 {
-    for (int i = 0; i < N; ++i) {
-        for (int j = 0; j < N; ++j) {
-            q_board::precompute_peers(i, j);
+    return candidates.nth(utils::uniform(candidates.count()));
+}
+
+/**
+ * @brief A DFS Sudoku Solver (with backtracking) that copies the whole board
+ * for each possibility it tries
+ *
+ * @param board Sudoku board reference that will be filled with the solution
+ * @param lim Limits of the search
+ * @return Status of the search
+ */
+template <typename Board>
+wfc::status solve_copy(Board& board, limits& lim)
+{
+    std::array<int, Board::dims::n> possibilities;
+
+    std::stack<Board> stk;
+    stk.push(board); // Pushes a copy of board to the top of the stack
+
+    // Decision level of each state of the stack, only kept for statistics
+    std::vector<uint64_t> depths;
+    if constexpr (stats::enabled) {
+        depths.push_back(0);
+    }
+
+    while (!stk.empty()) {
+        if (lim.interrupted()) {
+            return wfc::status::aborted;
+        }
+
+        Board curr = stk.top();
+        stk.pop();
+
+        uint64_t depth = 0;
+        if constexpr (stats::enabled) {
+            depth = depths.back();
+            depths.pop_back();
+            stats::depth(depth);
+        }
+
+        const auto opt_candidates = curr.get_candidates();
+
+        if (!opt_candidates.has_value()) {
+            // Found a state with no possible solution
+            // Backtracks to previous state
+            stats::backtrack();
+            continue;
+        }
+
+        const auto& candidates = opt_candidates.value();
+
+        if (!candidates.any()) {
+            // Found a solution
+            // Updates the board and returns
+            board = curr;
+            return wfc::status::solved;
+        }
+
+        if (lim.exceeded()) {
+            return wfc::status::aborted;
+        }
+
+        // Chooses randomly a tile among the candidates to collapse
+        stats::node();
+        const int chosen_idx = sample(candidates);
+        const int nb_possibilities = curr.get_tile(chosen_idx).get_possibilities(possibilities);
+
+        // Not actually necessary but prevents always trying the same
+        // order of possibilities over and over again
+        utils::shuffle(std::span(possibilities.data(), nb_possibilities));
+
+        for (int p = 0; p < nb_possibilities; ++p) {
+            // Since 'curr' is a reference,
+            // creates a copy directly on the top of the stack
+            // (avoiding unnecessary copies when pushing)
+            stk.emplace(curr);
+
+            // Checks if tile can be collapsed to chosen value
+            // If not, pop state from stack
+            if (!stk.top().collapse(chosen_idx, possibilities[p])) {
+                stats::backtrack();
+                stk.pop();
+
+            } else if constexpr (stats::enabled) {
+                depths.push_back(depth + 1);
+            }
         }
     }
+
+    return wfc::status::unsolvable;
 }
 
 /**
- * @brief Get the tiles with minimal entropy
+ * @brief A DFS Sudoku Solver (with backtracking) that works in place: tile
+ * changes are recorded on a trail and undone when backtracking
  *
- * @param board Current board reference
- * @return std::optional vector of tiles
+ * @param board Sudoku board reference that will be filled with the solution
+ * @param lim Limits of the search
+ * @return Status of the search
  */
-std::optional<std::vector<int>> get_candidates(const q_board& board)
+template <typename Board>
+wfc::status solve_trail(Board& board, limits& lim)
 {
-    int min_entropy = 2 * N;
+    // A decision per level, and each one collapses at least one tile
+    struct frame {
+        int index;                        // Collapsed tile
+        std::array<int, Board::dims::n> possibilities;
+        int nb_possibilities;
+        int next;                         // Next possibility to try
+        typename Board::checkpoint mark;  // State before the collapse
+    };
 
-    std::vector<int> candidates;
-    candidates.reserve(N * N);
+    std::array<frame, Board::dims::tiles> stk;
+    int depth = 0;
 
-    for (int index = 0; index < (N * N); index++) {
-        const q_tile& tile = board.get_tile(index);
+    typename Board::trail trail;
+    board.attach(&trail);
 
-        if (tile.has_collapsed()) {
-            continue;
+    while (true) {
+        if (lim.interrupted()) {
+            board.attach(nullptr);
+            return wfc::status::aborted;
         }
 
-        const int entropy = tile.get_entropy();
+        const auto opt_candidates = board.get_candidates();
 
-        if (!entropy) {
-            // No solution possible
-            // due to a conflict of collapsed tiles
-            return std::nullopt;
+        if (opt_candidates.has_value() && !opt_candidates->any()) {
+            // Found a solution
+            board.attach(nullptr);
+            return wfc::status::solved;
         }
 
-        if (entropy > min_entropy) {
-            continue;
+        if (!opt_candidates.has_value()) {
+            stats::backtrack();
+
+        } else if (lim.exceeded()) {
+            board.attach(nullptr);
+            return wfc::status::aborted;
+
+        } else {
+            // Opens a new level on a randomly chosen tile
+            stats::node();
+            stats::depth(depth + 1);
+
+            frame& f = stk[depth++];
+            f.index = sample(*opt_candidates);
+            f.nb_possibilities = board.get_tile(f.index).get_possibilities(f.possibilities);
+            f.next = 0;
+            f.mark = board.save();
+
+            utils::shuffle(std::span(f.possibilities.data(), f.nb_possibilities));
+        }
+
+        // Tries the next possibility of the deepest level,
+        // backtracking through the exhausted ones
+        bool collapsed = false;
+
+        while (depth > 0 && !collapsed) {
+            frame& f = stk[depth - 1];
+            board.restore(f.mark);
+
+            if (f.next == f.nb_possibilities) {
+                --depth;
+                continue;
+            }
+
+            collapsed = board.collapse(f.index, f.possibilities[f.next++]);
+            if (!collapsed) {
+                stats::backtrack();
+            }
         }
 
-        if (entropy < min_entropy) {
-            min_entropy = entropy;
-            candidates.clear();
+        if (!collapsed) {
+            board.attach(nullptr);
+            return wfc::status::unsolvable;
         }
-        candidates.push_back(index);
     }
+}
+
+/**
+ * @brief Exhaustive DFS that counts the solutions in place, up to a limit.
+ * Tiles and digits are tried in a fixed order: the lowest tile of minimal
+ * entropy, then digits in increasing order
+ *
+ * @param board Sudoku board reference, filled with the first solution found
+ * @param limit Nb of solutions at which the search stops
+ * @return Nb of solutions, at most limit
+ */
+template <typename Board>
+int count_trail(Board& board, const int limit)
+{
+    struct frame {
+        int index;
+        std::array<int, Board::dims::n> possibilities;
+        int nb_possibilities;
+        int next;
+        typename Board::checkpoint mark;
+    };
+
+    std::array<frame, Board::dims::tiles> stk;
+    int depth = 0;
+    int count = 0;
+    std::optional<Board> first;
+
+    typename Board::trail trail;
+    board.attach(&trail);
+
+    while (count < limit) {
+        const auto opt_candidates = board.get_candidates();
+
+        if (!opt_candidates.has_value()) {
+            stats::backtrack();
+
+        } else if (!opt_candidates->any()) {
+            // Found a solution, keeps on searching for the next one
+            if (!count++) {
+                first.emplace(board);
+                first->attach(nullptr);
+            }
+
+        } else {
+            stats::node();
+            stats::depth(depth + 1);
+
+            frame& f = stk[depth++];
+            f.index = opt_candidates->nth(0);
+            f.nb_possibilities = board.get_tile(f.index).get_possibilities(f.possibilities);
+            f.next = 0;
+            f.mark = board.save();
+        }
+
+        bool collapsed = false;
 
-    // Returns an empty vector
-    // if all tiles have collapsed
-    // i.e., if is a solution
-    candidates.shrink_to_fit();
-    return candidates;
+        while (depth > 0 && !collapsed && count < limit) {
+            frame& f = stk[depth - 1];
+            board.restore(f.mark);
+
+            if (f.next == f.nb_possibilities) {
+                --depth;
+                continue;
+            }
+
+            collapsed = board.collapse(f.index, f.possibilities[f.next++]);
+            if (!collapsed) {
+                stats::backtrack();
+            }
+        }
+
+        if (!collapsed) {
+            break;
+        }
+    }
+
+    board.attach(nullptr);
+    if (first) {
+        board = *first;
+    }
+    return count;
 }
 
 /**
- * @brief A DFS Sudoku Solver (with backtracking)
+ * @brief Term of the Luby sequence: 1 1 2 1 1 2 4 1 1 2 1 1 2 4 8 ...
+ *
+ * @param i Position, from 1
+ * @return Term
+ */
+inline uint64_t luby(uint64_t i)
+{
+    while (true) {
+        uint64_t k = 1;
+        while ((uint64_t{1} << k) - 1 < i) {
+            ++k;
+        }
+        if ((uint64_t{1} << k) - 1 == i) {
+            return uint64_t{1} << (k - 1);
+        }
+        // Same term as in the previous, shorter prefix of the sequence
+        i -= (uint64_t{1} << (k - 1)) - 1;
+    }
+}
+
+/**
+ * @brief Runs the chosen search engine once
  *
  * @param board Sudoku board reference that will be filled with the solution
- * @return true if solved,
- * @return false if not
+ * @param lim Limits of the search
+ * @param e Search engine
+ * @return Status of the search
  */
-bool wfc::solve(q_board& board)
+template <typename Board>
+wfc::status run_engine(Board& board, limits& lim, const wfc::engine e)
 {
-    std::stack<q_board> stk;
-    stk.push(board); // Pushes a copy of board to the top of the stack
+    switch (e) {
+    case wfc::engine::trail:
+        return solve_trail(board, lim);
 
-    while (!stk.empty()) {
-        q_board curr = stk.top();
-        stk.pop();
+    case wfc::engine::copy:
+    default:
+        return solve_copy(board, lim);
+    }
+}
+
+/**
+ * @brief Runs the chosen search engine. With restarts, the search starts over
+ * from the board each time it exceeds the budget of its run, base * luby(run)
+ * decisions, the random choices differing from one run to the next. This cuts
+ * the heavy tail of unlucky choices early in the tree
+ *
+ * @param board Sudoku board reference that will be filled with the solution
+ * @param options Engine and limits of the search
+ * @param found Optional flag raised when another search found the solution
+ * @return Status of the search
+ */
+template <typename Board>
+wfc::status solve_with(Board& board, const wfc::solve_options& options, const std::atomic_bool* found = nullptr)
+{
+    if (!options.restart_base) {
+        limits lim(options, found);
+        return run_engine(board, lim, options.e);
+    }
+
+    wfc::solve_options run_options = options;
+    uint64_t used = 0;  // Decisions of the previous runs
+
+    for (uint64_t run = 1;; ++run) {
+        // The overall budget, if any, caps the last run
+        run_options.max_nodes = options.restart_base * luby(run);
+        if (options.max_nodes) {
+            run_options.max_nodes = std::min(run_options.max_nodes, options.max_nodes - used);
+        }
+
+        Board attempt = board;
+        limits lim(run_options, found);
+        const wfc::status result = run_engine(attempt, lim, options.e);
+
+        if (result == wfc::status::solved) {
+            board = attempt;
+        }
+        if (result != wfc::status::aborted || !lim.over_budget()) {
+            // Solved, exhausted within the budget, or interrupted
+            return result;
+        }
+
+        used += run_options.max_nodes;
+        if (options.max_nodes && used >= options.max_nodes) {
+            return wfc::status::aborted;
+        }
+    }
+}
+
+/**
+ * @brief Splits the top of the search tree breadth first until there are a
+ * few subtrees per worker, then searches the subtrees concurrently, each on
+ * its own random stream whatever the worker. The first worker to find a
+ * solution stops all the others
+ *
+ * @param board Sudoku board reference that will be filled with the solution
+ * @param pool Thread pool running the subtrees
+ * @param options Engine and limits of each subtree
+ * @return Status of the search
+ */
+template <typename Board>
+wfc::status solve_parallel(Board& board, utils::thread_pool& pool, const wfc::solve_options& options)
+{
+    const std::size_t nb_subtrees = 4 * pool.size();
 
-        const auto opt_candidates = get_candidates(curr);
+    std::array<int, Board::dims::n> possibilities;
+    std::deque<Board> frontier{board};
+
+    while (!frontier.empty() && frontier.size() < nb_subtrees) {
+        const Board curr = std::move(frontier.front());
+        frontier.pop_front();
+
+        const auto opt_candidates = curr.get_candidates();
 
         if (!opt_candidates.has_value()) {
-            // Found a state with no possible solution
-            // Backtracks to previous state
+            stats::backtrack();
             continue;
         }
 
-        const std::vector<int>& candidates = opt_candidates.value();
-
-        if (candidates.empty()) {
-            // Found a solution
-            // Updates the board and returns
+        if (!opt_candidates->any()) {
             board = curr;
-            return true;
+            return wfc::status::solved;
         }
 
-        // Chooses randomly a tile among the candidates to collapse
-        const int chosen_idx = utils::sample(candidates);
-        std::vector<int> possibilities = curr.get_tile(chosen_idx).get_possibilities();
+        stats::node();
+        const int chosen_idx = sample(*opt_candidates);
+        const int nb_possibilities = curr.get_tile(chosen_idx).get_possibilities(possibilities);
 
-        // Not actually necessary but prevents always trying the same
-        // order of possibilities over and over again
-        utils::shuffle(possibilities);
+        for (int p = 0; p < nb_possibilities; ++p) {
+            Board next = curr;
+            if (next.collapse(chosen_idx, possibilities[p])) {
+                frontier.push_back(std::move(next));
+            } else {
+                stats::backtrack();
+            }
+        }
+    }
 
-        for (int chosen_val : possibilities) {
-            // Since 'curr' is a reference,
-            // creates a copy directly on the top of the stack
-            // (avoiding unnecessary copies when pushing)
-            stk.emplace(curr);
+    std::vector<Board> subtrees(frontier.begin(), frontier.end());
 
-            // Checks if tile can be collapsed to chosen value
-            // If not, pop state from stack
-            if (!stk.top().collapse(chosen_idx, chosen_val)) {
-                stk.pop();
+    // Streams of the subtrees follow from the stream of the caller
+    const uint64_t base = utils::rng()();
+
+    std::atomic_bool found = false;
+    std::atomic_bool aborted = false;
+
+    // Counters of the subtrees, gathered from the workers
+    stats::counters subtree_stats;
+    std::mutex stats_mtx;
+
+    pool.parallel_for(0, subtrees.size(), [&](const int begin, const int end) {
+        const stats::counters outer = stats::take();
+
+        for (int i = begin; i < end && !found; ++i) {
+            utils::seed(utils::stream_seed(base, i));
+
+            const wfc::status result = solve_with(subtrees[i], options, &found);
+
+            // Only the first worker to succeed writes the solution
+            if (result == wfc::status::solved && !found.exchange(true)) {
+                board = subtrees[i];
+            } else if (result == wfc::status::aborted) {
+                aborted = true;
+            }
+        }
+
+        if constexpr (stats::enabled) {
+            std::scoped_lock lock(stats_mtx);
+            subtree_stats += stats::take();
+            stats::local() = outer;
+        }
+    }, 1);
+
+    stats::add(subtree_stats);
+
+    if (found) {
+        return wfc::status::solved;
+    }
+    return aborted ? wfc::status::aborted : wfc::status::unsolvable;
+}
+
+/**
+ * @brief Races differently seeded copies of the board on a pool: the first
+ * copy to finish, solved or proved unsolvable, stops all the others. Copies
+ * wait in the queues until a worker is idle
+ *
+ * @param board Sudoku board reference that will be filled with the solution
+ * @param pool Thread pool running the copies
+ * @param options Engine and limits of each copy, portfolio being the nb of copies
+ * @return Status of the search
+ */
+template <typename Board>
+wfc::status solve_portfolio(Board& board, utils::thread_pool& pool, const wfc::solve_options& options)
+{
+    // Streams of the copies follow from the stream of the caller
+    const uint64_t base = utils::rng()();
+
+    // Copies start from a snapshot, the board is only written once all are done
+    const Board start = board;
+
+    std::atomic_bool finished = false;
+    std::atomic_bool aborted = false;
+    wfc::status outcome = wfc::status::unsolvable;
+    std::optional<Board> winner;
+
+    // Counters of the copies, gathered from the workers
+    stats::counters copy_stats;
+    std::mutex stats_mtx;
+
+    pool.parallel_for(0, options.portfolio, [&](const int begin, const int end) {
+        const stats::counters outer = stats::take();
+
+        for (int k = begin; k < end && !finished; ++k) {
+            utils::seed(utils::stream_seed(base, k));
+
+            Board copy = start;
+            const wfc::status result = solve_with(copy, options, &finished);
+
+            // Only the first copy to finish writes the outcome
+            if (result != wfc::status::aborted && !finished.exchange(true)) {
+                outcome = result;
+                if (result == wfc::status::solved) {
+                    winner = std::move(copy);
+                }
+            } else if (result == wfc::status::aborted) {
+                aborted = true;
             }
         }
+
+        if constexpr (stats::enabled) {
+            std::scoped_lock lock(stats_mtx);
+            copy_stats += stats::take();
+            stats::local() = outer;
+        }
+    }, 1);
+
+    stats::add(copy_stats);
+
+    if (winner) {
+        board = *winner;
+    }
+    if (finished) {
+        return outcome;
     }
+    return aborted ? wfc::status::aborted : wfc::status::unsolvable;
+}
 
-    return false;
+/**
+ * @brief A DFS Sudoku Solver (with backtracking)
+ *
+ * @param board Sudoku board reference that will be filled with the solution
+ * @param options Engine and limits of the search
+ * @return Status of the search
+ */
+template <int Box>
+wfc::status wfc::solve(q_board<Box>& board, const solve_options& options)
+{
+    return solve_with(board, options);
 }
 
+/**
+ * @brief A DFS Sudoku Solver (with backtracking) that searches the subtrees of
+ * a single board on all the workers of a pool, or races seeded copies of it
+ *
+ * @param board Sudoku board reference that will be filled with the solution
+ * @param pool Thread pool
+ * @param options Engine and limits of the search, the node budget applying to
+ * each subtree or copy
+ * @return Status of the search
+ */
+template <int Box>
+wfc::status wfc::solve(q_board<Box>& board, utils::thread_pool& pool, const solve_options& options)
+{
+    if (options.portfolio > 1) {
+        return solve_portfolio(board, pool, options);
+    }
+    return solve_parallel(board, pool, options);
+}
+
+/**
+ * @brief A DFS Sudoku Solver (with backtracking) on digit planes
+ *
+ * @param board Sudoku board reference that will be filled with the solution
+ * @param options Engine and limits of the search
+ * @return Status of the search
+ */
+wfc::status wfc::solve(bitboard& board, const solve_options& options)
+{
+    return solve_with(board, options);
+}
+
+/**
+ * @brief A DFS Sudoku Solver (with backtracking) on digit planes that searches
+ * the subtrees of a single board on all the workers of a pool, or races
+ * seeded copies of it
+ *
+ * @param board Sudoku board reference that will be filled with the solution
+ * @param pool Thread pool
+ * @param options Engine and limits of the search, the node budget applying to
+ * each subtree or copy
+ * @return Status of the search
+ */
+wfc::status wfc::solve(bitboard& board, utils::thread_pool& pool, const solve_options& options)
+{
+    if (options.portfolio > 1) {
+        return solve_portfolio(board, pool, options);
+    }
+    return solve_parallel(board, pool, options);
+}
+
+/**
+ * @brief Counts the solutions of a board, stopping at limit (e.g. 2 to check
+ * that a puzzle has a unique solution)
+ *
+ * @param board Sudoku board reference, filled with the first solution found
+ * @param limit Nb of solutions at which the search stops
+ * @return Nb of solutions, at most limit
+ */
+template <int Box>
+int wfc::count_solutions(q_board<Box>& board, const int limit)
+{
+    return count_trail(board, limit);
+}
+
+/**
+ * @brief Counts the solutions of a board on digit planes, stopping at limit
+ *
+ * @param board Sudoku board reference, filled with the first solution found
+ * @param limit Nb of solutions at which the search stops
+ * @return Nb of solutions, at most limit
+ */
+int wfc::count_solutions(bitboard& board, const int limit)
+{
+    return count_trail(board, limit);
+}
+
+/**
+ * @brief Estimates the hardness of a puzzle from the board its clues leave,
+ * before any search. Only singles are propagated, which keeps the estimate
+ * at the cost of a board construction
+ *
+ * @param grid Puzzle
+ * @return Estimate, all zero but the clues if they are inconsistent
+ */
+template <int Box>
+hardness estimate(std::string_view grid)
+{
+    using dims = utils::dims<Box>;
+
+    const q_board<Box> board(grid);
+    hardness h;
+
+    for (int idx = 0; idx < dims::tiles; ++idx) {
+        // Digits beyond the size of the grid are blanks to the board
+        const int digit = utils::to_digit(grid[idx]);
+        h.clues += (digit && digit <= dims::n);
+    }
+
+    if (board.has_contradiction()) {
+        // Fails at once
+        return h;
+    }
+
+    for (const q_tile<Box>& tile : board.get_grid()) {
+        if (!tile.has_collapsed()) {
+            h.unresolved++;
+            h.entropy += tile.get_entropy();
+        }
+    }
+    return h;
+}
+
+/**
+ * @brief Checks that a solution is a complete and valid grid that keeps the
+ * clues of the puzzle
+ *
+ * @param grid Original puzzle
+ * @param solution Proposed solution
+ * @return true if valid,
+ * @return false otherwise
+ */
+template <int Box>
+bool is_solution(std::string_view grid, std::string_view solution)
+{
+    using dims = utils::dims<Box>;
+
+    if (grid.size() < dims::tiles || solution.size() < dims::tiles) {
+        return false;
+    }
+
+    for (int idx = 0; idx < dims::tiles; ++idx) {
+        const int digit = utils::to_digit(solution[idx]);
+
+        if (!digit || digit > dims::n) {
+            return false;
+        }
+        if (utils::to_digit(grid[idx]) && grid[idx] != solution[idx]) {
+            return false;
+        }
+    }
+
+    for (const auto& unit : peers::lookup<Box>.units) {
+        typename dims::mask_t seen = 0;
+        for (const int idx : unit) {
+            seen = bit::set(seen, utils::to_digit(solution[idx]) - 1);
+        }
+        if (seen != init_state<Box>) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+template wfc::status wfc::solve(q_board<2>&, const solve_options&);
+template wfc::status wfc::solve(q_board<3>&, const solve_options&);
+template wfc::status wfc::solve(q_board<4>&, const solve_options&);
+template wfc::status wfc::solve(q_board<5>&, const solve_options&);
+
+template wfc::status wfc::solve(q_board<2>&, utils::thread_pool&, const solve_options&);
+template wfc::status wfc::solve(q_board<3>&, utils::thread_pool&, const solve_options&);
+template wfc::status wfc::solve(q_board<4>&, utils::thread_pool&, const solve_options&);
+template wfc::status wfc::solve(q_board<5>&, utils::thread_pool&, const solve_options&);
+
+template int wfc::count_solutions(q_board<2>&, const int);
+template int wfc::count_solutions(q_board<3>&, const int);
+template int wfc::count_solutions(q_board<4>&, const int);
+template int wfc::count_solutions(q_board<5>&, const int);
+
+template hardness estimate<2>(std::string_view);
+template hardness estimate<3>(std::string_view);
+template hardness estimate<4>(std::string_view);
+template hardness estimate<5>(std::string_view);
+
+template bool is_solution<2>(std::string_view, std::string_view);
+template bool is_solution<3>(std::string_view, std::string_view);
+template bool is_solution<4>(std::string_view, std::string_view);
+template bool is_solution<5>(std::string_view, std::string_view);
+
 }  // namespace sudoku
@@ -1,6 +1,15 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <stop_token>
+#include <string_view>
+
+#include "bitboard.hpp"
 #include "board.hpp"
+#include "utils.hpp"
 
 
 namespace sudoku
@@ -8,9 +17,64 @@ namespace sudoku
 
 namespace wfc
 {
-void init();
-bool solve(q_board& board);
+
+enum class engine {
+    copy,   // Copies the board for each possibility
+    trail,  // Undoes changes in place
+};
+
+enum class status {
+    solved,      // Board filled with a solution
+    unsolvable,  // Whole search space explored
+    aborted,     // Stopped by a limit or a cancellation
+};
+
+/**
+ * @brief Limits of a search, checked inside the DFS loop
+ */
+struct solve_options {
+    engine e = engine::copy;
+    uint64_t max_nodes = 0;  // Nb of decisions after which the search gives up, 0 for no limit
+    std::optional<std::chrono::steady_clock::time_point> deadline;
+    std::stop_token stop;                  // Stops the search once requested
+    const std::atomic_bool* cancel = nullptr;  // Stops the search once raised, e.g. from a signal handler
+    uint64_t restart_base = 0;  // Decisions of the first run of the Luby restart sequence, no restarts if 0
+    int portfolio = 0;          // Differently seeded copies raced on a pool instead of splitting the tree, if above 1
+    uint64_t preempt_every = 0;  // Decisions between the checkpoints at which a worker running a batch task
+                                 // runs the interactive tasks waiting, never if 0
+};
+
+template <int Box>
+status solve(q_board<Box>& board, const solve_options& options = {});
+status solve(bitboard& board, const solve_options& options = {});
+
+template <int Box>
+status solve(q_board<Box>& board, utils::thread_pool& pool, const solve_options& options = {});
+status solve(bitboard& board, utils::thread_pool& pool, const solve_options& options = {});
+
+template <int Box>
+int count_solutions(q_board<Box>& board, const int limit = 2);
+int count_solutions(bitboard& board, const int limit = 2);
 
 } // namespace wfc
 
+/**
+ * @brief Cheap estimate of how hard a puzzle is to search, read on the board
+ * once its clues are propagated
+ */
+struct hardness {
+    int clues = 0;       // Tiles given by the puzzle
+    int unresolved = 0;  // Tiles left open by the propagation
+    int entropy = 0;     // Sum of the entropies of the open tiles
+
+    // Harder puzzles have a larger key: entropy first, then open tiles
+    inline uint64_t key() const { return (static_cast<uint64_t>(entropy) << 32) | unresolved; }
+};
+
+template <int Box>
+hardness estimate(std::string_view grid);
+
+template <int Box>
+bool is_solution(std::string_view grid, std::string_view solution);
+
 } // namespace sudoku
@@ -1,58 +1,92 @@
 #include "utils.hpp"
 
+#include <latch>
+
 
 namespace utils
 {
 
 /**
- * @brief Sample one element of array
+ * @brief Random engine of the calling thread, seeded from the system on first
+ * use. Each worker owns its engine, so there is no sharing between threads.
+ *
+ * @return Reference to the thread's engine
+ */
+std::mt19937& rng()
+{
+    thread_local std::mt19937 g{std::random_device{}()};
+    return g;
+}
+
+/**
+ * @brief Reseeds the random engine of the calling thread
+ *
+ * @param value New seed
+ */
+void seed(const uint64_t value)
+{
+    rng().seed(static_cast<std::mt19937::result_type>(value ^ (value >> 32)));
+}
+
+/**
+ * @brief Derives the seed of an independent stream from a base seed
+ * (SplitMix64 finaliser), e.g. one stream per puzzle
+ *
+ * @param base Base seed of the run
+ * @param stream Stream id
+ * @return Stream seed
+ */
+uint64_t stream_seed(const uint64_t base, const uint64_t stream)
+{
+    uint64_t z = base + (stream + 1) * 0x9E37'79B9'7F4A'7C15;
+    z = (z ^ (z >> 30)) * 0xBF58'476D'1CE4'E5B9;
+    z = (z ^ (z >> 27)) * 0x94D0'49BB'1331'11EB;
+    return z ^ (z >> 31);
+}
+
+/**
+ * @brief Draw an integer uniformly
  *
- * @param array Array of values
- * @return Chosen value
+ * @param n Positive upper bound
+ * @return Value in [0, n)
  */
-int sample(const std::vector<int>& array)
+int uniform(const int n)
 {
-    std::vector<int> chosen;
-    std::sample(array.cbegin(), array.cend(), std::back_inserter(chosen), 1, g);
-    return chosen[0];
+    std::uniform_int_distribution<int> pick(0, n - 1);
+    return pick(rng());
 }
 
 /**
  * @brief Shuffle array
  *
- * @param array Reference to an array
+ * @param array View over an array
  */
-void shuffle(std::vector<int>& array)
+void shuffle(std::span<int> array)
 {
-    std::shuffle(array.begin(), array.end(), g);
+    std::shuffle(array.begin(), array.end(), rng());
 }
 
 
+namespace
+{
+
+// Pool and deque of the calling thread, if it is a worker
+thread_local thread_pool* worker_pool = nullptr;
+thread_local int worker_id = -1;
+
+// Class of the task the worker is running
+thread_local priority running = priority::batch;
+
+}  // namespace
+
+
 thread_pool::thread_pool(const int nb_threads)
+    : _queues(std::make_unique<worker_queue[]>(nb_threads))
 {
     _threads.reserve(nb_threads);
 
     for (int i = 0; i < nb_threads; ++i) {
-        _threads.emplace_back([this] {
-            while (true) {
-                Task task;
-                {
-                    // Pop from tasks
-                    std::unique_lock<std::mutex> lock(_mtx);
-                    _cv.wait(lock, [this]() {
-                        return !_tasks.empty() || _stop_pool;
-                    });
-
-                    if (_stop_pool && _tasks.empty()) {
-                        return;
-                    }
-
-                    task = std::move(_tasks.front());
-                    _tasks.pop();
-                }
-                task();
-            }
-        });
+        _threads.emplace_back([this, i] { work(i); });
     }
 }
 
@@ -70,13 +104,325 @@ thread_pool::~thread_pool()
     }
 }
 
-void thread_pool::enqueue(Task task)
+/**
+ * @brief Worker loop: runs tasks until the pool stops and no task is left
+ *
+ * @param id Worker id, i.e. its own deque
+ */
+void thread_pool::work(const int id)
+{
+    worker_pool = this;
+    worker_id = id;
+
+    Task task;
+    priority p;
+
+    while (true) {
+        if (try_pop(id, task, p)) {
+            run(task, p);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(_mtx);
+        _cv.wait(lock, [this]() {
+            return _pending > 0 || _stop_pool;
+        });
+
+        if (_stop_pool && _pending == 0) {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Takes the next task of a worker: an interactive task if any, unless
+ * the worker took too many in a row and a batch task is left
+ *
+ * @param id Deque of the caller
+ * @param task Reference filled with the taken task
+ * @param p Reference filled with the class of the task
+ * @return true if a task was taken
+ */
+bool thread_pool::try_pop(const int id, Task& task, priority& p)
+{
+    if (_pending == 0) {
+        return false;
+    }
+
+    int& streak = _queues[id].streak;
+
+    if (streak < batch_share && try_pop_urgent(task)) {
+        streak++;
+        p = priority::interactive;
+        return true;
+    }
+
+    if (try_pop_batch(id, task)) {
+        streak = 0;
+        p = priority::batch;
+        return true;
+    }
+
+    if (try_pop_urgent(task)) {
+        p = priority::interactive;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Takes a task from the back of a worker's own deque or, failing
+ * that, steals one from the front of another deque, so that the tasks already
+ * started finish first, or failing that, takes the oldest outside submission
+ *
+ * @param id Deque of the caller
+ * @param task Reference filled with the taken task
+ * @return true if a task was taken
+ */
+bool thread_pool::try_pop_batch(const int id, Task& task)
+{
+    const int nb_queues = size();
+
+    {
+        worker_queue& own = _queues[id];
+        std::lock_guard<std::mutex> lock(own.mtx);
+
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            _pending--;
+            return true;
+        }
+    }
+
+    for (int k = 1; k < nb_queues; ++k) {
+        worker_queue& victim = _queues[(id + k) % nb_queues];
+        std::lock_guard<std::mutex> lock(victim.mtx);
+
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            _pending--;
+            return true;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(_inject_mtx);
+
+    if (!_injected.empty()) {
+        task = std::move(_injected.front());
+        _injected.pop_front();
+        _pending--;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Takes the interactive task with the earliest deadline
+ *
+ * @param task Reference filled with the taken task
+ * @return true if a task was taken
+ */
+bool thread_pool::try_pop_urgent(Task& task)
+{
+    if (_nb_urgent == 0) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(_urgent_mtx);
+
+    if (_urgent.empty()) {
+        return false;
+    }
+
+    std::pop_heap(_urgent.begin(), _urgent.end());
+    urgent_task& top = _urgent.back();
+
+    if constexpr (stats::enabled) {
+        _urgent_waits.add(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - top.queued).count());
+    }
+
+    task = std::move(top.task);
+    _urgent.pop_back();
+    _nb_urgent--;
+    _pending--;
+    return true;
+}
+
+/**
+ * @brief Runs a task, recording its class for yield()
+ *
+ * @param task Task
+ * @param p Class of the task
+ */
+void thread_pool::run(Task& task, const priority p)
+{
+    const priority outer = running;
+    running = p;
+    task();
+    running = outer;
+}
+
+/**
+ * @brief Tells whether the caller is a worker running a batch task while
+ * interactive tasks wait, i.e. whether yield() would run anything
+ *
+ * @return true if the caller should yield
+ */
+bool thread_pool::preemptible()
 {
+    return worker_pool && running == priority::batch && worker_pool->_nb_urgent > 0;
+}
+
+/**
+ * @brief Checkpoint of a long batch task: runs on the calling worker the
+ * interactive tasks waiting, at most a few so that the batch task still
+ * progresses, then returns to the batch task. The interactive tasks run on
+ * the same thread, so the caller must save the thread-local state they may
+ * change
+ */
+void thread_pool::yield()
+{
+    if (!preemptible()) {
+        return;
+    }
+
+    Task task;
+    for (int k = 0; k < batch_share && worker_pool->try_pop_urgent(task); ++k) {
+        worker_pool->run(task, priority::interactive);
+    }
+}
+
+/**
+ * @brief Time interactive tasks waited before starting, recorded when
+ * statistics are built in
+ *
+ * @return Histogram of the waits
+ */
+stats::histogram thread_pool::interactive_waits() const
+{
+    std::lock_guard<std::mutex> lock(_urgent_mtx);
+    return _urgent_waits;
+}
+
+/**
+ * @brief Deque of the calling thread
+ *
+ * @return Worker id, -1 if the caller is not a worker of this pool
+ */
+int thread_pool::current_worker() const
+{
+    return (worker_pool == this) ? worker_id : -1;
+}
+
+/**
+ * @brief Accounts for new tasks and wakes workers up
+ *
+ * @param nb_tasks Nb of pushed tasks
+ */
+void thread_pool::notify(const int nb_tasks)
+{
+    _pending += nb_tasks;
     {
+        // Pairs with the predicate check of sleeping workers
         std::lock_guard<std::mutex> lock(_mtx);
-        _tasks.emplace(std::move(task));
     }
-    _cv.notify_one();
+
+    if (nb_tasks == 1) {
+        _cv.notify_one();
+    } else {
+        _cv.notify_all();
+    }
+}
+
+/**
+ * @brief Submits a task. Batch tasks of a worker go to its own deque, those
+ * of other threads to the back of the injection queue. Interactive tasks go to
+ * their own queue, ordered by deadline, tasks without one coming after the others in
+ * submission order
+ *
+ * @param task Task to run
+ * @param p Class of the task
+ * @param deadline Time the task should start by, interactive tasks only
+ */
+void thread_pool::enqueue(Task task, const priority p, const std::optional<clock::time_point> deadline)
+{
+    if (p == priority::interactive) {
+        {
+            std::lock_guard<std::mutex> lock(_urgent_mtx);
+
+            const clock::time_point queued = stats::enabled ? clock::now() : clock::time_point{};
+            _urgent.push_back({deadline.value_or(clock::time_point::max()), _urgent_order++, queued, std::move(task)});
+            std::push_heap(_urgent.begin(), _urgent.end());
+            _nb_urgent++;
+        }
+        notify(1);
+        return;
+    }
+
+    if (const int id = current_worker(); id >= 0) {
+        std::lock_guard<std::mutex> lock(_queues[id].mtx);
+        _queues[id].tasks.emplace_back(std::move(task));
+    } else {
+        std::lock_guard<std::mutex> lock(_inject_mtx);
+        _injected.emplace_back(std::move(task));
+    }
+    notify(1);
+}
+
+/**
+ * @brief Runs body over [begin, end) split in chunks, dealt as contiguous
+ * blocks to the workers' deques so that idle workers steal the leftovers.
+ * Returns once every chunk is done.
+ *
+ * @param begin First index
+ * @param end Past the last index
+ * @param body Callable run on each sub-range [a, b)
+ * @param chunk Nb of indices per chunk, 0 to deal 8 chunks per worker
+ */
+void thread_pool::parallel_for(const int begin, const int end, const RangeTask& body, int chunk)
+{
+    const int range = end - begin;
+    if (range <= 0) {
+        return;
+    }
+
+    const int nb_queues = size();
+    if (chunk <= 0) {
+        chunk = std::max(1, range / (8 * nb_queues));
+    }
+
+    const int nb_chunks = (range + chunk - 1) / chunk;
+    std::latch done(nb_chunks);
+
+    for (int q = 0, c = 0; q < nb_queues; ++q) {
+        // Chunks [c, last) go to deque q
+        const int last = static_cast<int64_t>(q + 1) * nb_chunks / nb_queues;
+
+        std::lock_guard<std::mutex> lock(_queues[q].mtx);
+        for (; c < last; ++c) {
+            const int a = begin + c * chunk;
+            const int b = std::min(end, a + chunk);
+
+            _queues[q].tasks.emplace_back([&body, &done, a, b] {
+                body(a, b);
+                done.count_down();
+            });
+        }
+    }
+    notify(nb_chunks);
+
+    // A worker caller helps while there is something to take,
+    // then waits for the chunks in flight
+    if (const int id = current_worker(); id >= 0) {
+        Task task;
+        priority p;
+        while (!done.try_wait() && try_pop(id, task, p)) {
+            run(task, p);
+        }
+    }
+    done.wait();
 }
 
 }  // namespace utils
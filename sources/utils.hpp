@@ -1,49 +1,176 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstdint>
+#include <deque>
 #include <functional>
+#include <memory>
 #include <mutex>
-#include <queue>
+#include <optional>
 #include <random>
+#include <span>
+#include <string_view>
 #include <thread>
+#include <type_traits>
 #include <vector>
 
-#define N 9
-#define BOX 3
+#include "stats.hpp"
+
+// Board of the backends specialised for 9x9 grids
+// (digit planes, binary format, OR-Tools models)
+inline constexpr int BOX = 3;
+inline constexpr int N = BOX * BOX;
 
 namespace utils
 {
 
-inline std::array<int, 2> array2grid(const int index) { return {(index / N), (index % N)}; }
-inline int grid2array(const int i, const int j) { return i * N + j; }
+/**
+ * @brief Sizes of a board made of Box x Box boxes of Box x Box tiles
+ */
+template <int Box>
+struct dims {
+    static constexpr int box = Box;
+    static constexpr int n = Box * Box;  // Digits, and tiles per row, col or box
+    static constexpr int tiles = n * n;
+
+    // n possibilities plus the collapsed flag
+    using mask_t = std::conditional_t<(n < 16), uint16_t, uint32_t>;
+
+    static_assert(Box >= 2 && Box <= 5, "Supported boards are 4x4 up to 25x25");
+};
+
+inline constexpr std::string_view digits = "123456789ABCDEFGHIJKLMNOP";
+
+/**
+ * @brief Digit written as a character, '1'-'9' then 'A' for 10 onwards
+ *
+ * @param c Character
+ * @return Digit, 0 for a blank
+ */
+inline constexpr int to_digit(const char c)
+{
+    if (c >= '1' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'A' && c <= 'P') {
+        return c - 'A' + 10;
+    }
+    return 0;
+}
+
+inline constexpr char to_char(const int digit) { return digit ? digits[digit - 1] : '.'; }
+
+/**
+ * @brief Box size of a grid written on one line
+ *
+ * @param grid Line of the grid, trailing whitespace ignored
+ * @return Box size of the grid with exactly that many tiles, 0 if none has
+ */
+inline constexpr int box_of(std::string_view grid)
+{
+    const std::size_t size = grid.find_last_not_of(" \t\r\n") + 1;  // 0 if blank
+
+    for (int box = 5; box >= 2; --box) {
+        if (size == static_cast<std::size_t>(box * box * box * box)) {
+            return box;
+        }
+    }
+    return 0;
+}
 
-#ifdef DEBUG
-inline std::seed_seq seed{2};
-inline std::mt19937 g(seed);
-#else
-inline std::random_device rd;
-inline std::mt19937 g(rd());
-#endif
+std::mt19937& rng();
+void seed(const uint64_t value);
+uint64_t stream_seed(const uint64_t base, const uint64_t stream);
 
-int sample(const std::vector<int>& array);
-void shuffle(std::vector<int>& array);
+int uniform(const int n);
+void shuffle(std::span<int> array);
 
 using Task = std::function<void()>;
+using RangeTask = std::function<void(int, int)>;
+
+enum class priority {
+    batch,        // Injection queue in submission order, or the deque of the submitting worker
+    interactive,  // Shared queue served before the batch tasks, earliest deadline first
+};
 
+/**
+ * @brief Work-stealing thread pool: each worker pops the tasks it submitted
+ * itself from the back of its own deque and, when it runs dry, steals from the
+ * front of the others, then takes the oldest task submitted from outside the
+ * pool, so that outside submissions start in order.
+ * Interactive tasks skip ahead of all of them, except that every few
+ * interactive tasks in a row a worker takes a batch task, so that batches
+ * still progress under a flood of interactive tasks. Long batch tasks may
+ * also let the interactive tasks run in the middle of their work by calling
+ * yield() at their checkpoints
+ */
 class thread_pool
 {
 public:
+    using clock = std::chrono::steady_clock;
+
     thread_pool(const int nb_threads);
     ~thread_pool();
-    void enqueue(Task task);
+
+    inline int size() const { return _threads.size(); }
+
+    void enqueue(Task task, const priority p = priority::batch, const std::optional<clock::time_point> deadline = {});
+    void parallel_for(const int begin, const int end, const RangeTask& body, int chunk = 0);
+
+    static bool preemptible();
+    static void yield();
+
+    stats::histogram interactive_waits() const;
 
 private:
+    // Interactive tasks taken in a row before a batch task goes first
+    static constexpr int batch_share = 8;
+
+    struct alignas(64) worker_queue {
+        std::mutex mtx;
+        std::deque<Task> tasks;
+        int streak = 0;  // Interactive tasks taken in a row by the worker
+    };
+
+    struct urgent_task {
+        clock::time_point deadline;
+        uint64_t order;             // Submission order, among equal deadlines
+        clock::time_point queued;   // Submission time, when statistics are built in
+        Task task;
+
+        // Heap order: the earliest deadline, then the oldest task, on top
+        inline bool operator<(const urgent_task& o) const
+        {
+            return deadline != o.deadline ? deadline > o.deadline : order > o.order;
+        }
+    };
+
+    void work(const int id);
+    bool try_pop(const int id, Task& task, priority& p);
+    bool try_pop_batch(const int id, Task& task);
+    bool try_pop_urgent(Task& task);
+    void run(Task& task, const priority p);
+    int current_worker() const;
+    void notify(const int nb_tasks);
+
     std::vector<std::thread> _threads;
-    std::queue<Task> _tasks;
+    std::unique_ptr<worker_queue[]> _queues;
+    std::atomic_int _pending = 0;       // Queued tasks not taken yet
+    std::mutex _inject_mtx;
+    std::deque<Task> _injected;         // Injection queue: batch tasks submitted from outside the pool, oldest first
     std::condition_variable _cv;
     std::mutex _mtx;
 
+    mutable std::mutex _urgent_mtx;
+    std::vector<urgent_task> _urgent;   // Heap of the interactive tasks
+    std::atomic_int _nb_urgent = 0;
+    uint64_t _urgent_order = 0;
+    stats::histogram _urgent_waits;     // Time from submission to start of the interactive tasks
+
     bool _stop_pool = false;
 };
 
@@ -0,0 +1,377 @@
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <semaphore>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "codec.hpp"
+#include "io.hpp"
+#include "server.hpp"
+#include "sudoku.hpp"
+#include "utils.hpp"
+
+
+namespace
+{
+
+using clock_type = std::chrono::steady_clock;
+
+struct response {
+    uint64_t id;
+    server::status status;
+    std::string solution;  // Empty if none
+    uint64_t latency;      // Reported by the server, in ns
+};
+
+/**
+ * @brief Nearest-rank percentile
+ *
+ * @param sorted Sorted samples
+ * @param q Quantile in [0, 1]
+ * @return Sample at the quantile, 0 if there is none
+ */
+uint64_t percentile(const std::vector<uint64_t>& sorted, const double q)
+{
+    if (sorted.empty()) {
+        return 0;
+    }
+    const std::size_t rank = std::ceil(q * sorted.size());
+    return sorted[std::clamp<std::size_t>(rank, 1, sorted.size()) - 1];
+}
+
+/**
+ * @brief Writes a whole buffer on a socket
+ *
+ * @param fd Socket
+ * @param data Buffer
+ * @return false if the server is gone
+ */
+bool send_all(const int fd, std::string_view data)
+{
+    while (!data.empty()) {
+        const ssize_t n = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        data.remove_prefix(n);
+    }
+    return true;
+}
+
+/**
+ * @brief Prints the median, tail and max of latencies
+ *
+ * @param label Name of the latencies
+ * @param samples Latencies in ns, sorted in place
+ */
+void report(const std::string_view label, std::vector<uint64_t>& samples)
+{
+    std::sort(samples.begin(), samples.end());
+    std::cout << label << ": p50 " << percentile(samples, 0.50) * 1e-3 << "us, p99 " << percentile(samples, 0.99) * 1e-3
+              << "us, max " << percentile(samples, 1.0) * 1e-3 << "us\n";
+}
+
+/**
+ * @brief Parses the complete responses at the front of the input
+ *
+ * @param pending Input read and not parsed yet, complete responses removed
+ * @param responses Parsed responses, appended to
+ */
+void parse(std::string& pending, std::vector<response>& responses)
+{
+    std::size_t pos = 0;
+
+    while (pos < pending.size()) {
+        if (static_cast<uint8_t>(pending[pos]) == server::frame_marker) {
+            if (pending.size() - pos < server::response_frame_size) {
+                break;
+            }
+
+            response r;
+            std::memcpy(&r.id, pending.data() + pos + 1, sizeof(r.id));
+            r.status = static_cast<server::status>(pending[pos + 9]);
+            std::memcpy(&r.latency, pending.data() + pos + 10, sizeof(r.latency));
+
+            if (r.status == server::status::solved) {
+                r.solution.resize(N * N);
+                codec::decode(reinterpret_cast<const uint8_t*>(pending.data() + pos + 18), r.solution.data());
+            }
+
+            responses.push_back(std::move(r));
+            pos += server::response_frame_size;
+            continue;
+        }
+
+        const std::size_t eol = pending.find('\n', pos);
+        if (eol == std::string::npos) {
+            break;
+        }
+
+        // "<id> <status> <solution or -> <latency_ns>"
+        const std::string_view line(pending.data() + pos, eol - pos);
+        pos = eol + 1;
+
+        std::vector<std::string_view> fields;
+        for (std::size_t begin = 0; begin < line.size();) {
+            const std::size_t end = std::min(line.find(' ', begin), line.size());
+            fields.push_back(line.substr(begin, end - begin));
+            begin = end + 1;
+        }
+
+        if (fields.size() != 4) {
+            std::cerr << "Unexpected response '" << line << "'.\n";
+            continue;
+        }
+
+        response r{0, server::status::malformed, "", 0};
+        std::from_chars(fields[0].data(), fields[0].data() + fields[0].size(), r.id);
+        std::from_chars(fields[3].data(), fields[3].data() + fields[3].size(), r.latency);
+
+        for (const server::status s : {server::status::solved, server::status::unsolvable, server::status::aborted}) {
+            if (fields[1] == server::name(s)) {
+                r.status = s;
+            }
+        }
+        if (fields[2] != "-") {
+            r.solution = fields[2];
+        }
+
+        responses.push_back(std::move(r));
+    }
+
+    pending.erase(0, pos);
+}
+
+/**
+ * @brief Checks a solution against the rules of the grid size
+ *
+ * @param grid Original puzzle
+ * @param solution Proposed solution
+ * @return true if valid
+ */
+bool is_solution(std::string_view grid, std::string_view solution)
+{
+    switch (utils::box_of(grid)) {
+    case 2:
+        return sudoku::is_solution<2>(grid, solution);
+    case 3:
+        return sudoku::is_solution<3>(grid, solution);
+    case 4:
+        return sudoku::is_solution<4>(grid, solution);
+    case 5:
+        return sudoku::is_solution<5>(grid, solution);
+    default:
+        return false;
+    }
+}
+
+}  // namespace
+
+
+/**
+ * @brief Sends the puzzles of a file to a server, pipelined within a window
+ * of requests in flight, and reports the latencies
+ */
+int main(int argc, const char* argv[])
+{
+    std::vector<std::string_view> positionals;
+    bool binary = false;
+    bool verify = false;
+    std::ptrdiff_t window = 64;
+    std::size_t every = 0;     // Every nth request is interactive, none if 0
+    bool tagged = true;        // Interactive requests sent as such, else only measured apart
+    std::string deadline;      // Of interactive requests in ms, none if empty
+
+    for (int a = 1; a < argc; ++a) {
+        const std::string_view arg = argv[a];
+
+        if (arg == "--binary") {
+            binary = true;
+        } else if (arg == "--verify") {
+            verify = true;
+        } else if (arg.starts_with("--window=")) {
+            window = std::max(1, std::stoi(std::string(arg.substr(9))));
+        } else if (arg.starts_with("--interactive=")) {
+            every = std::max(0, std::stoi(std::string(arg.substr(14))));
+        } else if (arg.starts_with("--deadline=")) {
+            deadline = std::to_string(std::max(0, std::stoi(std::string(arg.substr(11)))));
+        } else if (arg == "--no-priority") {
+            tagged = false;
+        } else if (!arg.starts_with("--")) {
+            positionals.push_back(arg);
+        } else {
+            positionals.clear();
+            break;
+        }
+    }
+
+    if (positionals.empty() || positionals.size() > 2) {
+        std::cerr << "Usage: sudoku_client <socket> [file] [--binary] [--window=<n>] [--verify]\n"
+                  << "                     [--interactive=<k>] [--deadline=<ms>] [--no-priority]\n";
+        return 1;
+    }
+
+    const std::filesystem::path socket_path(positionals[0]);
+    const std::filesystem::path path(positionals.size() > 1 ? positionals[1] : "data/hard10.txt");
+
+    io::mapped_file file(path);
+    if (!file.is_open()) {
+        std::cerr << "File '" << path.string() << "' not found.\n";
+        return 1;
+    }
+
+    // Puzzles, the id of a request being its index
+    std::vector<std::string_view> grids;
+    {
+        io::line_reader reader(file.data());
+        std::vector<std::string_view> lines;
+
+        while (reader.next(lines, 4096)) {
+            for (const std::string_view line : lines) {
+                if (binary && utils::box_of(line) != BOX) {
+                    // Only 9x9 grids are packed
+                    continue;
+                }
+                grids.push_back(binary ? line.substr(0, N * N) : line);
+            }
+        }
+    }
+
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socket_path.native().size() >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path too long.\n";
+        return 1;
+    }
+    std::strcpy(address.sun_path, socket_path.c_str());
+
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || ::connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0) {
+        std::cerr << "Cannot connect to '" << socket_path.string() << "': " << std::strerror(errno) << "\n";
+        return 1;
+    }
+
+    const auto interactive = [every](const std::size_t id) { return every && id % every == every - 1; };
+
+    std::vector<clock_type::time_point> sent(grids.size());
+    std::counting_semaphore<> slots(window);
+
+    const auto begin = clock_type::now();
+
+    std::thread sender([&] {
+        std::string request;
+
+        for (std::size_t id = 0; id < grids.size(); ++id) {
+            slots.acquire();
+
+            const bool urgent = tagged && interactive(id);
+
+            request.clear();
+            if (binary) {
+                // The binary protocol has no deadline
+                request.resize(server::request_frame_size);
+                request[0] = static_cast<char>(urgent ? server::interactive_marker : server::frame_marker);
+                std::memcpy(request.data() + 1, &id, sizeof(uint64_t));
+                codec::encode(grids[id], reinterpret_cast<uint8_t*>(request.data() + 9));
+            } else {
+                request.append(std::to_string(id));
+                if (urgent) {
+                    request.append("!").append(deadline);
+                }
+                request.append(" ").append(grids[id]).append("\n");
+            }
+
+            sent[id] = clock_type::now();
+            if (!send_all(fd, request)) {
+                break;
+            }
+        }
+        // Done writing, the server answers what is in flight then closes
+        ::shutdown(fd, SHUT_WR);
+    });
+
+    std::vector<response> responses;
+    std::vector<uint64_t> round_trips;
+    std::vector<uint64_t> interactive_trips;
+    std::string pending;
+    std::vector<char> chunk(1 << 16);
+    std::size_t received = 0;
+
+    round_trips.reserve(grids.size());
+
+    for (ssize_t n; received < grids.size() && (n = ::read(fd, chunk.data(), chunk.size())) > 0;) {
+        const auto now = clock_type::now();
+
+        pending.append(chunk.data(), n);
+        parse(pending, responses);
+
+        for (; received < responses.size(); ++received) {
+            const uint64_t id = responses[received].id;
+            if (id < sent.size()) {
+                const uint64_t trip = std::chrono::duration_cast<std::chrono::nanoseconds>(now - sent[id]).count();
+                (interactive(id) ? interactive_trips : round_trips).push_back(trip);
+            }
+            slots.release();
+        }
+    }
+
+    const double seconds = std::chrono::duration<double>(clock_type::now() - begin).count();
+
+    // Unblocks the sender if the server left early
+    ::shutdown(fd, SHUT_RDWR);
+    slots.release(grids.size());
+    sender.join();
+    ::close(fd);
+
+    std::vector<uint64_t> latencies;
+    std::vector<uint64_t> interactive_latencies;
+    std::array<std::size_t, 4> statuses{};
+    std::size_t reordered = 0;
+    std::size_t invalid = 0;
+
+    for (std::size_t k = 0; k < responses.size(); ++k) {
+        const response& r = responses[k];
+
+        (r.id < grids.size() && interactive(r.id) ? interactive_latencies : latencies).push_back(r.latency);
+        statuses[static_cast<int>(r.status)]++;
+        reordered += (r.id != k);
+
+        if (verify && r.status == server::status::solved &&
+            (r.id >= grids.size() || !is_solution(grids[r.id], r.solution))) {
+            invalid++;
+        }
+    }
+
+    std::cout << responses.size() << "/" << grids.size() << " responses in " << seconds << "s ("
+              << responses.size() / seconds << " requests/s, window " << window << ")\n"
+              << "Solved: " << statuses[0] << ", unsolvable: " << statuses[1] << ", aborted: " << statuses[2]
+              << ", malformed: " << statuses[3] << ", out of order: " << reordered << "\n";
+
+    report(every ? "Batch server latency" : "Server latency", latencies);
+    report(every ? "Batch round trip" : "Round trip", round_trips);
+
+    if (every) {
+        std::cout << interactive_latencies.size() << " interactive requests, " << (tagged ? "tagged" : "untagged")
+                  << "\n";
+        report("Interactive server latency", interactive_latencies);
+        report("Interactive round trip", interactive_trips);
+    }
+
+    if (verify) {
+        std::cout << "Invalid solutions: " << invalid << "\n";
+    }
+
+    return responses.size() == grids.size() ? 0 : 1;
+}